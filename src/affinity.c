@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * CPU and NUMA placement of devices.
+ *
+ * The library runs its handlers on whatever thread the application
+ * calls them from, so a device's affinity is advice: applications
+ * with a thread per device (or per group of devices) pin those threads
+ * with backend_apply_affinity(). backend_alloc_local() hands out memory
+ * first touched from the device's CPUs, hence placed on their node
+ * under the default local allocation policy.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+
+#include "project.h"
+#include "backend.h"
+
+static enum xen_affinity_policy policy = XEN_AFFINITY_NONE;
+static unsigned int spread_next = 0;
+
+static void cpuset_to_sys(const struct xen_cpuset *set, cpu_set_t *sys)
+{
+    int cpu;
+
+    CPU_ZERO(sys);
+    for (cpu = 0; cpu < XEN_CPUSET_SIZE && cpu < CPU_SETSIZE; cpu++) {
+        if (XEN_CPU_ISSET(cpu, set))
+            CPU_SET(cpu, sys);
+    }
+}
+
+#if defined(HAVE_XC_DOMAIN_NODE_GETAFFINITY) && \
+    defined(HAVE_XC_GET_MAX_NODES) && defined(HAVE_XC_CPUTOPOINFO) && \
+    defined(HAVE_XC_VCPU_GETAFFINITY)
+# define HAVE_HOST_TOPOLOGY 1
+#endif
+
+#ifdef HAVE_HOST_TOPOLOGY
+# define MAP_ISSET(i, map)      ((map)[(i) / 8] & (1 << ((i) % 8)))
+
+/* Nodes domid's memory is placed on, NULL if it is not placed */
+static xc_nodemap_t domain_nodes(int domid, int *max_nodes)
+{
+    xc_nodemap_t nodemap;
+    int node;
+
+    *max_nodes = xc_get_max_nodes(xc_handle);
+    if (*max_nodes <= 1)
+        return NULL;
+
+    nodemap = calloc((*max_nodes + 7) / 8, 1);
+    if (!nodemap)
+        return NULL;
+
+    if (xc_domain_node_getaffinity(xc_handle, domid, nodemap))
+        goto fail;
+
+    /* All nodes set means "no placement", which is no hint at all */
+    for (node = 0; node < *max_nodes; node++) {
+        if (!MAP_ISSET(node, nodemap))
+            return nodemap;
+    }
+fail:
+    free(nodemap);
+    return NULL;
+}
+
+/* The node all the pCPUs in map are on, -1 if they span several */
+static int cpumap_node(xc_cpumap_t map, const xc_cputopo_t *topo,
+                       unsigned int ncpus)
+{
+    unsigned int cpu;
+    int node = -1;
+
+    for (cpu = 0; cpu < ncpus; cpu++) {
+        if (!MAP_ISSET(cpu, map))
+            continue;
+        if (topo[cpu].node == XEN_INVALID_NODE_ID ||
+            (node != -1 && topo[cpu].node != (unsigned int)node))
+            return -1;
+        node = topo[cpu].node;
+    }
+    return node;
+}
+#endif
+
+/*
+ * CPUs of ours that run on the nodes the frontend domain's memory is
+ * placed on. Our CPU numbers are vCPU ids, which only say where they
+ * run through pinning: a vCPU qualifies if its hard affinity keeps it
+ * on a single node of the host's pCPU topology, and that node holds
+ * the frontend's memory. Unpinned vCPUs never do, so without pinning
+ * devices are spread instead.
+ */
+static int frontend_cpus(struct xen_backend *xenback, struct xen_cpuset *set)
+{
+#ifdef HAVE_HOST_TOPOLOGY
+    xc_nodemap_t nodemap;
+    xc_cputopo_t *topo = NULL;
+    xc_cpumap_t hard = NULL, soft = NULL;
+    xc_dominfo_t info;
+    unsigned int ncpus = 0;
+    unsigned int vcpu;
+    int max_nodes;
+    int node;
+    int found = 0;
+
+    nodemap = domain_nodes(xenback->domid, &max_nodes);
+    if (!nodemap)
+        return -1;
+
+    if (xc_domain_getinfo(xc_handle, self_domid, 1, &info) != 1 ||
+        info.domid != (uint32_t)self_domid)
+        goto out;
+
+    if (xc_cputopoinfo(xc_handle, &ncpus, NULL) || !ncpus)
+        goto out;
+    topo = calloc(ncpus, sizeof (*topo));
+    hard = xc_cpumap_alloc(xc_handle);
+    soft = xc_cpumap_alloc(xc_handle);
+    if (!topo || !hard || !soft ||
+        xc_cputopoinfo(xc_handle, &ncpus, topo))
+        goto out;
+
+    for (vcpu = 0; vcpu <= info.max_vcpu_id && vcpu < XEN_CPUSET_SIZE;
+         vcpu++) {
+        if (xc_vcpu_getaffinity(xc_handle, self_domid, vcpu, hard, soft,
+                                XEN_VCPUAFFINITY_HARD))
+            continue;
+        node = cpumap_node(hard, topo, ncpus);
+        if (node != -1 && node < max_nodes && MAP_ISSET(node, nodemap)) {
+            XEN_CPU_SET(vcpu, set);
+            found = 1;
+        }
+    }
+
+out:
+    free(soft);
+    free(hard);
+    free(topo);
+    free(nodemap);
+
+    return found ? 0 : -1;
+#else
+    (void)xenback;
+    (void)set;
+    return -1;
+#endif
+}
+
+static int spread_cpu(void)
+{
+    long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+    if (ncpus <= 0)
+        ncpus = 1;
+    if (ncpus > XEN_CPUSET_SIZE)
+        ncpus = XEN_CPUSET_SIZE;
+
+    return __sync_fetch_and_add(&spread_next, 1) % ncpus;
+}
+
+INTERNAL void
+affinity_init_device(struct xen_device *xendev)
+{
+    struct xen_cpuset set;
+
+    if (policy == XEN_AFFINITY_NONE)
+        return;
+
+    memset(&set, 0, sizeof (set));
+    if (policy == XEN_AFFINITY_FRONTEND &&
+        !frontend_cpus(xendev->backend, &set)) {
+        backend_set_affinity(xendev->backend, xendev->devid, &set);
+        return;
+    }
+
+    XEN_CPU_SET(spread_cpu(), &set);
+    backend_set_affinity(xendev->backend, xendev->devid, &set);
+}
+
+EXTERNAL void
+backend_set_affinity_policy(enum xen_affinity_policy p)
+{
+    policy = p;
+}
+
+EXTERNAL int
+backend_set_affinity(xen_backend_t xenback, int devid,
+                     const struct xen_cpuset *set)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!set) {
+        free(xendev->affinity);
+        xendev->affinity = NULL;
+        return 0;
+    }
+
+    if (!xendev->affinity) {
+        xendev->affinity = malloc(sizeof (*xendev->affinity));
+        if (!xendev->affinity)
+            return -1;
+    }
+    *xendev->affinity = *set;
+
+    return 0;
+}
+
+/* Returns -1 if the device has no affinity */
+EXTERNAL int
+backend_get_affinity(xen_backend_t xenback, int devid,
+                     struct xen_cpuset *set)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!xendev->affinity)
+        return -1;
+    *set = *xendev->affinity;
+    return 0;
+}
+
+/* Pin the calling thread to the device's CPUs */
+EXTERNAL int
+backend_apply_affinity(xen_backend_t xenback, int devid)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+    cpu_set_t sys;
+
+    if (!xendev->affinity)
+        return -1;
+
+    cpuset_to_sys(xendev->affinity, &sys);
+    return sched_setaffinity(0, sizeof (sys), &sys);
+}
+
+/*
+ * Allocate size bytes of zeroed memory, first touched from the device's
+ * CPUs. Release with backend_free_local().
+ */
+EXTERNAL void *
+backend_alloc_local(xen_backend_t xenback, int devid, unsigned long size)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+    cpu_set_t saved, sys;
+    long pagesz = sysconf(_SC_PAGESIZE);
+    int pinned = 0;
+    unsigned long off;
+    char *p;
+
+    p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+        return NULL;
+
+    if (xendev->affinity && !sched_getaffinity(0, sizeof (saved), &saved)) {
+        cpuset_to_sys(xendev->affinity, &sys);
+        pinned = !sched_setaffinity(0, sizeof (sys), &sys);
+    }
+
+    for (off = 0; off < size; off += pagesz)
+        p[off] = 0;
+
+    if (pinned)
+        sched_setaffinity(0, sizeof (saved), &saved);
+
+    return p;
+}
+
+EXTERNAL void
+backend_free_local(void *p, unsigned long size)
+{
+    if (p)
+        munmap(p, size);
+}
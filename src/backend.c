@@ -16,11 +16,26 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <stddef.h>
+
 #include "project.h"
 #include "backend.h"
 
-static xc_interface *xc_handle = NULL;
+/*
+ * Fail to compile if the event path fields spill out of the first cache
+ * line, or the device out of two.
+ */
+typedef char xen_device_hot_fields_fit
+    [offsetof(struct xen_device, be_state) <= CACHELINE_SZ ? 1 : -1];
+typedef char xen_device_fits
+    [sizeof (struct xen_device) <= 2 * CACHELINE_SZ ? 1 : -1];
+
+xc_interface *xc_handle = NULL;
 struct xs_handle *xs_handle = NULL;
+int self_domid = 0;
+struct xen_backend_list backends = LIST_HEAD_INITIALIZER;
+pthread_mutex_t backends_lock = PTHREAD_MUTEX_INITIALIZER;
+
 static char domain_path[PATH_BUFSZ];
 static int domain_path_len = 0;
 
@@ -29,6 +44,8 @@ backend_init(int backend_domid)
 {
     char *tmp;
 
+    self_domid = backend_domid;
+
     xs_handle = xs_open(XS_UNWATCH_FILTER);
     if (!xs_handle)
         goto fail_xs;
@@ -44,6 +61,8 @@ backend_init(int backend_domid)
     domain_path_len = snprintf(domain_path, PATH_BUFSZ, "%s", tmp);
     free(tmp);
 
+    fd_notify_xenstore(XEN_FD_ADD);
+
     return 0;
 fail_domainpath:
     xc_interface_close(xc_handle);
@@ -59,39 +78,73 @@ fail_xs:
 EXTERNAL int
 backend_close(void)
 {
-    if (xs_handle)
+    if (xs_handle) {
+        fd_notify_xenstore(XEN_FD_DEL);
         xs_daemon_close(xs_handle);
+    }
     xs_handle = NULL;
 
     if (xc_handle)
         xc_interface_close(xc_handle);
     xc_handle = NULL;
+
+    timer_fd_close();
 }
 
 static int setup_watch(struct xen_backend *xenback, const char *type, int domid)
 {
+    char token[TOKEN_BUFSZ];
+    char path[PATH_BUFSZ];
     int sz;
 
-    sz = snprintf(xenback->token, TOKEN_BUFSZ, MAGIC_STRING"%p", xenback);
+    sz = snprintf(token, TOKEN_BUFSZ, MAGIC_STRING"%p", xenback);
     if (sz < 0 || sz >= TOKEN_BUFSZ)
         return -1;
 
-    sz = snprintf(xenback->path, PATH_BUFSZ, "%s/backend/%s/%d",
+    sz = snprintf(path, PATH_BUFSZ, "%s/backend/%s/%d",
                   domain_path, type, domid);
     if (sz < 0 || sz >= PATH_BUFSZ)
         return -1;
+
+    xenback->path = strdup(path);
+    if (!xenback->path)
+        return -1;
     xenback->path_len = sz;
 
-    if (!xs_watch(xs_handle, xenback->path, xenback->token)) {
+    if (!xs_watch(xenback->xsh, xenback->path, token)) {
+        free(xenback->path);
+        xenback->path = NULL;
         return -1;
     }
 
     return 0;
 }
 
-static void free_device(struct xen_backend *xenback, int devid)
+/*
+ * Freeing a device is done in three steps, so that release_backends()
+ * can run the middle one on other threads: detach_device() takes the
+ * device off the state shared with the rest of the library, which is
+ * not locked; teardown_device() runs the callbacks and drops the
+ * frontend watch; close_device() closes and unmaps what the device
+ * holds.
+ */
+static void detach_device(struct xen_device *xendev)
 {
-    struct xen_device *xendev = &xenback->devices[devid];
+    sched_dequeue(xendev);
+    timer_stop(&xendev->cold->timer);
+
+    /* The device is going away, so are writes to it not yet published */
+    wc_release(xendev);
+
+    fd_notify_device(xendev, XEN_FD_DEL);
+    xendev->detached = 1;
+}
+
+static void teardown_device(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+
+    PROBE2(free_device, xenback->domid, xendev->devid);
 
     if (xenback->ops->disconnect)
         xenback->ops->disconnect(xendev->dev);
@@ -99,53 +152,143 @@ static void free_device(struct xen_backend *xenback, int devid)
     if (xenback->ops->free)
         xenback->ops->free(xendev->dev);
 
-    if (xendev->be) {
-        free(xendev->be);
-        xendev->be = NULL;
-    }
-
     if (xendev->fe) {
         char token[TOKEN_BUFSZ];
 
         snprintf(token, TOKEN_BUFSZ, MAGIC_STRING"%p", xendev);
-        xs_unwatch(xs_handle, xendev->fe, token);
+        xs_unwatch(xenback->xsh, xendev->fe, token);
         free(xendev->fe);
         xendev->fe = NULL;
     }
 
+    if (xendev->protocol) {
+        free(xendev->protocol);
+        xendev->protocol = NULL;
+    }
+
+    free(xendev->poll);
+    xendev->poll = NULL;
+
+    free(xendev->affinity);
+    xendev->affinity = NULL;
+
+    free(xendev->cold->snapshot);
+    xendev->cold->snapshot = NULL;
+    xendev->quiesced = 0;
+    xendev->quiesce_masked = 0;
+    xendev->cold->quiesce_pending = 0;
+}
+
+static void close_device(struct xen_device *xendev)
+{
     if (xendev->evtchndev) {
         xc_evtchn_close(xendev->evtchndev);
+        xendev->evtchndev = NULL;
+        xendev->local_port = -1;
     }
+    xendev->cold->auto_bound = 0;
 
-    if (xendev->protocol)
-        free(xendev->protocol);
+    if (xendev->cold->auto_ring)
+        munmap(xendev->cold->auto_ring, XC_PAGE_SIZE);
+    xendev->cold->auto_ring = NULL;
+    xendev->cold->ring = NULL;
+
+    device_gnttab_close(xendev);
 
+    xendev->detached = 0;
     xendev->dev = NULL;
 }
 
+static void free_device(struct xen_backend *xenback, int devid)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    detach_device(xendev);
+    teardown_device(xendev);
+    close_device(xendev);
+}
+
+/*
+ * The device stayed in its state for longer than
+ * backend_set_state_timeout() allows: close it, so the toolstack can
+ * tell, and release everything it holds. The slot is left alone until
+ * the device is removed from xenstore.
+ */
+INTERNAL void
+reclaim_device(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+
+    PROBE3(reclaim_device, xenback->domid, xendev->devid, xendev->be_state);
+
+    xs_write_be_int(xendev, "state", XenbusStateClosed);
+    wc_flush(xenback);
+
+    free_device(xenback, xendev->devid);
+    xendev->cold->reclaimed = 1;
+}
+
+/*
+ * Returns NULL if the alloc callback failed (returned NULL): the slot
+ * is left free, to be tried again on the device's next watch event or
+ * scan.
+ */
 static struct xen_device *alloc_device(struct xen_backend *xenback, int devid)
 {
     struct xen_device *xendev = &xenback->devices[devid];
 
     xendev->backend = xenback;
+    xendev->devid = devid;
     xendev->local_port = -1;
-
-    xendev->be = calloc(1, PATH_BUFSZ);
-    if (!xendev->be)
-        return NULL;
-    snprintf(xendev->be, PATH_BUFSZ, "%s/%d", xenback->path, devid);
+    xendev->cold->fe_ring_ref = -1;
+    xendev->cold->fe_evtchn = -1;
+    xendev->cold->handshake_ts = now_ns();
 
     xendev->evtchndev = xc_evtchn_open(NULL, 0);
     if (xendev->evtchndev) {
         fcntl(xc_evtchn_fd(xendev->evtchndev), F_SETFD, FD_CLOEXEC);
     }
 
+    sched_init_device(xendev);
+    affinity_init_device(xendev);
+
     if (xenback->ops->alloc)
         xendev->dev = xenback->ops->alloc(xenback, devid, xenback->priv);
+    PROBE2(alloc_device, xenback->domid, devid);
+    if (!xendev->dev) {
+        backend_set_affinity(xenback, devid, NULL);
+        close_device(xendev);
+        return NULL;
+    }
+
+    fd_notify_device(xendev, XEN_FD_ADD);
 
     return xendev;
 }
 
+/*
+ * Watch paths are decoded with fixed offsets and a single pass over
+ * the digits of the devid: the backend watch fires for
+ * <xenback->path>[/<devid>[/<node>]], a frontend watch for
+ * <xendev->fe>[/<node>], so the prefixes never need comparing.
+ */
+static int parse_devid(const char *p, const char **end)
+{
+    int devid = 0;
+
+    if (*p < '0' || *p > '9')
+        return -1;
+    while (*p >= '0' && *p <= '9') {
+        devid = devid * 10 + (*p++ - '0');
+        if (devid >= BACKEND_DEVICE_MAX)
+            return -1;
+    }
+    if (end)
+        *end = p;
+
+    return devid;
+}
+
 static void scan_devices(struct xen_backend *xenback)
 {
     char **dirent;
@@ -154,24 +297,26 @@ static void scan_devices(struct xen_backend *xenback)
 
     memset(scanned, 0, sizeof (scanned));
 
-    dirent = xs_directory(xs_handle, 0, xenback->path, &len);
+    dirent = xs_directory(xenback->xsh, 0, xenback->path, &len);
+    PROBE2(scan_devices, xenback->domid, dirent ? (int)len : -1);
     if (dirent) {
         for (i = 0; i < len; i++) {
-            int rc;
             int devid;
             struct xen_device *xendev;
 
-            rc = sscanf(dirent[i], "%d", &devid);
-            if (rc != 1)
+            devid = parse_devid(dirent[i], NULL);
+            if (devid == -1)
                 continue;
 
             scanned[devid] = 1;
             xendev = &xenback->devices[devid];
 
-            if (xendev->dev != NULL)
+            if (xendev->dev != NULL || xendev->cold->reclaimed)
                 continue;
 
             xendev = alloc_device(xenback, devid);
+            if (!xendev)
+                continue;
 
             check_state_early(xendev);
             check_state(xendev);
@@ -186,95 +331,487 @@ static void scan_devices(struct xen_backend *xenback)
 
     /* Detect devices removed from xenstore */
     for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
-        if (xenback->devices[i].dev && scanned[i] == 0)
+        if (scanned[i])
+            continue;
+        if (xenback->devices[i].dev)
             free_device(xenback, i);
+        xenback->cold[i].reclaimed = 0;
     }
 }
 
-EXTERNAL xen_backend_t
-backend_register(const char *type,
-                 int domid,
-                 struct xen_backend_ops *ops,
-                 backend_private_t priv)
+static struct xen_backend *new_backend(const char *type, int domid,
+                                       struct xen_backend_ops *ops,
+                                       backend_private_t priv)
 {
     struct xen_backend *xenback;
-    int rc;
+    int rc, i;
+
+    /* Keep each device on its own cache lines (see backend.h) */
+    if (posix_memalign((void **)&xenback, CACHELINE_SZ, sizeof (*xenback)))
+        return NULL;
+    memset(xenback, 0, sizeof (*xenback));
 
-    xenback = calloc(1, sizeof (*xenback));
-    if (xenback == NULL)
+    xenback->cold = calloc(BACKEND_DEVICE_MAX, sizeof (*xenback->cold));
+    if (!xenback->cold) {
+        free(xenback);
         return NULL;
+    }
+    for (i = 0; i < BACKEND_DEVICE_MAX; i++)
+        xenback->devices[i].cold = &xenback->cold[i];
 
     xenback->ops = ops;
     xenback->domid = domid;
     xenback->type = type;
     xenback->priv = priv;
+    xenback->xsh = xs_handle;
+
+    if (keys_init(xenback)) {
+        free(xenback->cold);
+        free(xenback);
+        return NULL;
+    }
 
     rc = setup_watch(xenback, type, domid);
     if (rc) {
+        keys_release(xenback);
+        free(xenback->cold);
         free(xenback);
         return NULL;
     }
 
+    pthread_mutex_lock(&backends_lock);
+    LIST_INSERT_HEAD(&backends, xenback, link);
+    pthread_mutex_unlock(&backends_lock);
+
+    return xenback;
+}
+
+EXTERNAL xen_backend_t
+backend_register(const char *type,
+                 int domid,
+                 struct xen_backend_ops *ops,
+                 backend_private_t priv)
+{
+    struct xen_backend *xenback;
+
+    xenback = new_backend(type, domid, ops, priv);
+    if (!xenback)
+        return NULL;
+
     scan_devices(xenback);
+    wc_flush(xenback);
 
     return xenback;
 }
 
+/*
+ * One step of the initial scan of backend_register_async(): list the
+ * devices, then set up one of them per step, so the application's
+ * loop gets to run in between.
+ */
+static void sync_step(void *arg)
+{
+    struct xen_backend *xenback = arg;
+    struct xen_device *xendev;
+    char **dirent;
+    unsigned int len, i;
+    int devid;
+
+    if (!xenback->sync_listed) {
+        dirent = xs_directory(xenback->xsh, 0, xenback->path, &len);
+        if (!dirent && errno != ENOENT) {
+            timer_start(&xenback->sync_timer, SYNC_RETRY_MS, sync_step,
+                        xenback);
+            return;
+        }
+        for (i = 0; dirent && i < len; i++) {
+            devid = parse_devid(dirent[i], NULL);
+            if (devid != -1)
+                xenback->sync_pending |= 1U << devid;
+        }
+        free(dirent);
+        xenback->sync_listed = 1;
+    } else if (xenback->sync_pending) {
+        devid = ffs(xenback->sync_pending) - 1;
+        xenback->sync_pending &= ~(1U << devid);
+
+        /* Already picked up if a watch event for it came first */
+        xendev = &xenback->devices[devid];
+        if (!xendev->dev && !xendev->cold->reclaimed &&
+            (xendev = alloc_device(xenback, devid))) {
+            check_state_early(xendev);
+            check_state(xendev);
+            wc_flush(xenback);
+        }
+    }
+
+    if (xenback->sync_pending) {
+        timer_start(&xenback->sync_timer, 0, sync_step, xenback);
+        return;
+    }
+
+    /* Catch up with devices removed in the meantime */
+    xenback->syncing = 0;
+    scan_devices(xenback);
+    wc_flush(xenback);
+
+    PROBE1(backend_synced, xenback->domid);
+    if (xenback->synced)
+        xenback->synced(xenback, xenback->priv);
+}
+
+/*
+ * Like backend_register(), but returns once the watch is set up. The
+ * devices already in xenstore are then set up one at a time from
+ * backend_timer_handler(), and synced(), if not NULL, is called once
+ * all have been. Watch events for a device are handled as they come,
+ * whether or not its turn has come yet. The application must service
+ * the timers (see backend_timer_fd() and backend_timer_timeout()), or
+ * the scan never runs.
+ */
+EXTERNAL xen_backend_t
+backend_register_async(const char *type,
+                       int domid,
+                       struct xen_backend_ops *ops,
+                       backend_private_t priv,
+                       xen_backend_synced_t synced)
+{
+    struct xen_backend *xenback;
+
+    xenback = new_backend(type, domid, ops, priv);
+    if (!xenback)
+        return NULL;
+
+    xenback->synced = synced;
+    xenback->syncing = 1;
+    timer_start(&xenback->sync_timer, 0, sync_step, xenback);
+
+    return xenback;
+}
+
+struct teardown
+{
+    struct xen_device           **devs;
+    unsigned int                count;
+    unsigned int                next;
+};
+
+static void *teardown_worker(void *opaque)
+{
+    struct teardown *td = opaque;
+    unsigned int i;
+
+    while ((i = __sync_fetch_and_add(&td->next, 1)) < td->count)
+        teardown_device(td->devs[i]);
+
+    return NULL;
+}
+
+/*
+ * Tear down the backends on list, their devices spread over up to
+ * nthreads threads. Only the callbacks and frontend unwatches run on
+ * those: devices are detached from the library's shared state before
+ * the threads start, and their handles closed in one pass once they
+ * are done. Returns the number of devices torn down.
+ */
+static int release_backends(struct xen_backend_list *list,
+                            unsigned int nthreads)
+{
+    struct xen_backend *xenback, *next;
+    struct xen_device *stack[BACKEND_DEVICE_MAX];
+    struct teardown td;
+    pthread_t threads[TEARDOWN_THREADS_MAX];
+    unsigned int nbackends = 0;
+    unsigned int started = 0;
+    unsigned int i;
+
+    LIST_FOREACH(xenback, list, link)
+        nbackends++;
+
+    td.devs = stack;
+    if (nbackends > 1) {
+        td.devs = malloc(nbackends * BACKEND_DEVICE_MAX * sizeof (*td.devs));
+        if (!td.devs) {
+            td.devs = stack;
+            nthreads = 1;
+        }
+    }
+    td.count = 0;
+    td.next = 0;
+
+    LIST_FOREACH_SAFE(xenback, next, list, link) {
+        char token[TOKEN_BUFSZ];
+
+        snprintf(token, TOKEN_BUFSZ, MAGIC_STRING"%p", xenback);
+        xs_unwatch(xenback->xsh, xenback->path, token);
+        timer_stop(&xenback->sync_timer);
+
+        for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+            struct xen_device *xendev = &xenback->devices[i];
+
+            if (!xendev->dev)
+                continue;
+
+            if (td.devs == stack && td.count == BACKEND_DEVICE_MAX) {
+                free_device(xenback, i);
+                continue;
+            }
+
+            detach_device(xendev);
+            td.devs[td.count++] = xendev;
+        }
+    }
+
+    if (nthreads > TEARDOWN_THREADS_MAX)
+        nthreads = TEARDOWN_THREADS_MAX;
+    if (nthreads > td.count)
+        nthreads = td.count;
+
+    for (i = 1; i < nthreads; i++) {
+        if (pthread_create(&threads[started], NULL, teardown_worker, &td))
+            break;
+        started++;
+    }
+    teardown_worker(&td);
+    for (i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    for (i = 0; i < td.count; i++)
+        close_device(td.devs[i]);
+
+    LIST_FOREACH_SAFE(xenback, next, list, link) {
+        LIST_REMOVE(xenback, link);
+        keys_release(xenback);
+        free(xenback->path);
+        free(xenback->cold);
+        free(xenback);
+    }
+
+    if (td.devs != stack)
+        free(td.devs);
+
+    return td.count;
+}
+
 EXTERNAL void
 backend_release(xen_backend_t xenback)
 {
+    struct xen_backend_list list = LIST_HEAD_INITIALIZER;
+
+    pthread_mutex_lock(&backends_lock);
+    LIST_REMOVE(xenback, link);
+    pthread_mutex_unlock(&backends_lock);
+
+    LIST_INSERT_HEAD(&list, xenback, link);
+    release_backends(&list, 1);
+}
+
+/*
+ * Declare that the disconnect and free callbacks of xenback may run
+ * concurrently for different devices, on threads other than the one
+ * servicing the library, as backend_release_domain() runs them.
+ */
+EXTERNAL void
+backend_set_thread_safe(xen_backend_t xenback, int safe)
+{
+    xenback->thread_safe = !!safe;
+}
+
+/*
+ * Release every backend serving domain domid, e.g. once it has been
+ * destroyed, with the device teardowns run on up to nthreads threads.
+ * Call it from the thread that services the library. With nthreads > 1
+ * the disconnect and free callbacks run on the other threads too, so
+ * every backend of domid must have been declared thread safe with
+ * backend_set_thread_safe(); if one has not, nothing is released and
+ * -1 is returned (errno EINVAL). Returns the number of devices torn
+ * down; the time it took is stored in *elapsed_ns if not NULL.
+ */
+EXTERNAL int
+backend_release_domain(int domid, unsigned int nthreads,
+                       unsigned long long *elapsed_ns)
+{
+    struct xen_backend_list list = LIST_HEAD_INITIALIZER;
+    struct xen_backend *xenback, *next;
+    unsigned long long start = now_ns();
+    int n;
+
+    pthread_mutex_lock(&backends_lock);
+    if (nthreads > 1) {
+        LIST_FOREACH(xenback, &backends, link) {
+            if (xenback->domid == domid && !xenback->thread_safe) {
+                pthread_mutex_unlock(&backends_lock);
+                errno = EINVAL;
+                return -1;
+            }
+        }
+    }
+    LIST_FOREACH_SAFE(xenback, next, &backends, link) {
+        if (xenback->domid != domid)
+            continue;
+        LIST_REMOVE(xenback, link);
+        LIST_INSERT_HEAD(&list, xenback, link);
+    }
+    pthread_mutex_unlock(&backends_lock);
+
+    n = release_backends(&list, nthreads);
+
+    if (elapsed_ns)
+        *elapsed_ns = now_ns() - start;
+    PROBE3(release_domain, domid, n, now_ns() - start);
+
+    return n;
+}
+
+/*
+ * Watch events queued before a backend or device was released carry
+ * tokens pointing to freed memory; only follow tokens that still point
+ * to a registered backend, or a device in one.
+ */
+INTERNAL struct xen_backend *
+live_backend(void *p)
+{
+    struct xen_backend *xenback;
+
+    pthread_mutex_lock(&backends_lock);
+    LIST_FOREACH(xenback, &backends, link) {
+        if ((void *)xenback == p ||
+            ((void *)&xenback->devices[0] <= p &&
+             p < (void *)&xenback->devices[BACKEND_DEVICE_MAX]))
+            break;
+    }
+    pthread_mutex_unlock(&backends_lock);
+
+    return xenback;
+}
+
+static int device_match(struct xen_backend *xenback,
+                        struct xen_backend *which, int domid)
+{
+    if (which)
+        return xenback == which;
+    return domid == -1 || xenback->domid == domid;
+}
+
+/*
+ * The devices of backend which, or else of the backends serving domid
+ * (all backends if -1), NULL terminated; NULL if out of memory. Taken
+ * under backends_lock, so that callbacks can then be run on them
+ * without it.
+ */
+INTERNAL struct xen_device **
+collect_devices(struct xen_backend *which, int domid)
+{
+    struct xen_backend *xenback;
+    struct xen_device **devs;
+    unsigned int n = 0;
     int i;
 
-    xs_unwatch(xs_handle, xenback->path, xenback->token);
+    pthread_mutex_lock(&backends_lock);
 
-    for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
-        if (xenback->devices[i].dev) {
-            free_device(xenback, i);
+    LIST_FOREACH(xenback, &backends, link) {
+        if (!device_match(xenback, which, domid))
+            continue;
+        for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+            if (xenback->devices[i].dev)
+                n++;
         }
     }
 
-    free(xenback);
+    devs = malloc((n + 1) * sizeof (*devs));
+    if (devs) {
+        n = 0;
+        LIST_FOREACH(xenback, &backends, link) {
+            if (!device_match(xenback, which, domid))
+                continue;
+            for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+                if (xenback->devices[i].dev)
+                    devs[n++] = &xenback->devices[i];
+            }
+        }
+        devs[n] = NULL;
+    }
+
+    pthread_mutex_unlock(&backends_lock);
+
+    return devs;
+}
+
+/* Whether a collected device is still there, callbacks having run since */
+INTERNAL int
+device_live(struct xen_device *xendev)
+{
+    return live_backend(xendev) && xendev->dev;
 }
 
-static int get_devid_from_path(struct xen_backend *xenback, char *path)
+INTERNAL int
+decode_backend_path(struct xen_backend *xenback, char *path, char **node)
 {
+    const char *p = path + xenback->path_len;
     int devid;
-    int rc;
-    char dummy[PATH_BUFSZ];
 
-    rc = sscanf(path + xenback->path_len, "/%d/%255s", &devid, dummy);
-    if (rc == 2)
-        return devid;
+    *node = NULL;
+    if (*p++ != '/')
+        return -1;
 
-    rc = sscanf(path + xenback->path_len, "/%d", &devid);
-    if (rc == 1)
-        return devid;
+    devid = parse_devid(p, &p);
+    if (devid == -1)
+        return -1;
 
-    return -1;
+    if (*p == '/')
+        *node = (char *)p + 1;
+    else if (*p != '\0')
+        return -1;
+
+    return devid;
 }
 
-static char *get_node_from_path(char *base, char *path)
+INTERNAL char *
+decode_frontend_path(struct xen_device *xendev, char *path)
 {
-    int len = strlen(base);
-
-    if (strncmp(base, path, len))
+    if (path[xendev->fe_len] != '/')
         return NULL;
-    if (path[len] != '/')
+
+    return path + xendev->fe_len + 1;
+}
+
+/* Token is MAGIC_STRING followed by a pointer printed with %p */
+INTERNAL void *
+decode_token(const char *token)
+{
+    unsigned long v = 0;
+    const char *p;
+
+    if (memcmp(token, MAGIC_STRING, sizeof (MAGIC_STRING) - 1))
         return NULL;
 
-    return path + len + 1;
+    p = token + sizeof (MAGIC_STRING) - 1;
+    if (p[0] == '0' && p[1] == 'x')
+        p += 2;
+    for (; *p; p++) {
+        if (*p >= '0' && *p <= '9')
+            v = (v << 4) | (*p - '0');
+        else if (*p >= 'a' && *p <= 'f')
+            v = (v << 4) | (*p - 'a' + 10);
+        else
+            return NULL;
+    }
+
+    return (void *)v;
 }
 
-static void update_device(struct xen_backend *xenback, int devid, char *path)
+static void update_device(struct xen_backend *xenback, int devid, char *node)
 {
     struct xen_device *xendev = &xenback->devices[devid];
-    char *node = NULL;
+
+    if (xendev->cold->reclaimed)
+        return;
 
     if (xendev->dev == NULL)
         xendev = alloc_device(xenback, devid);
+    if (!xendev)
+        return;
 
-    if (xendev->be)
-        node = get_node_from_path(xendev->be, path);
     backend_changed(xendev, node);
     check_state(xendev);
 }
@@ -291,7 +828,6 @@ backend_xenstore_handler(void *unused)
     char **w;
     unsigned int count;
     void *p;
-    int rc;
     char *node;
 
     (void)unused;
@@ -300,19 +836,29 @@ backend_xenstore_handler(void *unused)
     if (!w)
         return;
 
-    rc = sscanf(w[XS_WATCH_TOKEN], MAGIC_STRING"%p", &p);
-    if (rc != 1)
+    p = decode_token(w[XS_WATCH_TOKEN]);
+    if (!p || !live_backend(p)) {
+        free(w);
         return;
+    }
 
     if (!strncmp(w[XS_WATCH_PATH], domain_path, domain_path_len)) {
         int devid;
         struct xen_backend *xenback = p;
 
-        devid = get_devid_from_path(xenback, w[XS_WATCH_PATH]);
+        devid = decode_backend_path(xenback, w[XS_WATCH_PATH], &node);
         if (devid != -1) {
-            update_device(xenback, devid, w[XS_WATCH_PATH]);
+            update_device(xenback, devid, node);
         }
-        scan_devices(xenback);
+        /*
+         * A node below a device we have changed: no device came or
+         * went, so there is nothing for a rescan to find. Until the
+         * initial scan is done, sync_step() does the scanning.
+         */
+        if (!xenback->syncing &&
+            (devid == -1 || !node || !xenback->devices[devid].dev))
+            scan_devices(xenback);
+        wc_flush(xenback);
     } else {
         struct xen_device *xendev = p;
 
@@ -321,8 +867,9 @@ backend_xenstore_handler(void *unused)
         ** unwatching the node. (yes, yes, it happens...)
         */
         if (xendev->dev) {
-            node = get_node_from_path(xendev->fe, w[XS_WATCH_PATH]);
+            node = decode_frontend_path(xendev, w[XS_WATCH_PATH]);
             update_frontend(xendev, node);
+            wc_flush(xendev->backend);
         }
     }
 
@@ -340,20 +887,28 @@ backend_bind_evtchn(xen_backend_t xenback, int devid)
 {
     struct xen_device *xendev = &xenback->devices[devid];
     int remote_port;
-    int rc;
 
-    rc = xs_read_fe_int(xendev, "event-channel", &remote_port);
-    if (rc)
+    if (xendev->cold->fe_evtchn != -1)
+        remote_port = xendev->cold->fe_evtchn;
+    else if (xs_read_fe_int(xendev, "event-channel", &remote_port))
         return -1;
 
-    if (xendev->local_port != -1)
+    if (xendev->local_port != -1) {
+        /* Bound by auto-connect, ahead of the connect callback */
+        if (xendev->cold->auto_bound)
+            return xc_evtchn_fd(xendev->evtchndev);
         return -1;
+    }
 
     xendev->local_port = xc_evtchn_bind_interdomain(xendev->evtchndev,
                                                     xenback->domid,
                                                     remote_port);
+    PROBE4(bind_evtchn, xenback->domid, devid, remote_port,
+           xendev->local_port);
     if (xendev->local_port == -1)
         return -1;
+    xendev->cold->remote_port = remote_port;
+    fd_notify_device(xendev, XEN_FD_MOD);
 
     return xc_evtchn_fd(xendev->evtchndev);
 }
@@ -366,8 +921,11 @@ backend_unbind_evtchn(xen_backend_t xenback, int devid)
     if (xendev->local_port == -1)
         return;
 
+    PROBE3(unbind_evtchn, xenback->domid, devid, xendev->local_port);
+
     xc_evtchn_unbind(xendev->evtchndev, xendev->local_port);
     xendev->local_port = -1;
+    fd_notify_device(xendev, XEN_FD_MOD);
 }
 
 EXTERNAL int
@@ -394,33 +952,77 @@ backend_evtchn_handler(void *priv)
     int port;
 
     port = xc_evtchn_pending(xendev->evtchndev);
+    PROBE4(evtchn_handler, xenback->domid, xendev->devid, port,
+           xendev->local_port);
     if (port != xendev->local_port)
         return;
+
+    /* Left masked until backend_resume() */
+    if (xendev->quiesced) {
+        xendev->quiesce_masked = 1;
+        return;
+    }
     xc_evtchn_unmask(xendev->evtchndev, port);
 
+    /* Bound by auto-connect ahead of the connect callback: not yet ours */
+    if (xendev->cold->auto_bound && xendev->be_state != XenbusStateConnected)
+        return;
+
+    if (sched_enabled()) {
+        sched_enqueue(xendev);
+        return;
+    }
+
     if (xenback->ops->event)
         xenback->ops->event(xendev->dev);
+
+    if (xendev->poll)
+        busy_poll(xendev);
+
+    wc_flush(xenback);
 }
 
 EXTERNAL void *
 backend_map_shared_page(xen_backend_t xenback, int devid)
 {
     struct xen_device *xendev = &xenback->devices[devid];
+    void *page;
     int mfn;
-    int rc;
 
-    rc = xs_read_fe_int(xendev, "page-ref", &mfn);
-    if (rc)
+    if (xendev->cold->fe_ring_ref != -1)
+        mfn = xendev->cold->fe_ring_ref;
+    else if (xs_read_fe_int(xendev, "page-ref", &mfn))
         return NULL;
 
-    return xc_map_foreign_range(xc_handle, xenback->domid,
+    /* Mapped by auto-connect, which keeps it until the disconnect */
+    if (xendev->cold->auto_ring && xendev->cold->auto_ring_mfn == mfn)
+        return xendev->cold->auto_ring;
+
+    page = xc_map_foreign_range(xc_handle, xenback->domid,
                                 XC_PAGE_SIZE, PROT_READ | PROT_WRITE,
                                 mfn);
+    PROBE4(map_shared_page, xenback->domid, devid, mfn, page);
+    if (!page)
+        return NULL;
+
+    /* Recorded for backend_checkpoint() */
+    xendev->cold->ring = page;
+    xendev->cold->ring_mfn = mfn;
+
+    return page;
 }
 
 EXTERNAL void
 backend_unmap_shared_page(xen_backend_t xenback, int devid, void *page)
 {
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    PROBE3(unmap_shared_page, xenback->domid, devid, page);
+
+    if (page == xendev->cold->auto_ring)
+        return;
+
+    if (page == xendev->cold->ring)
+        xendev->cold->ring = NULL;
     munmap(page, XC_PAGE_SIZE);
 }
-
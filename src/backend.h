@@ -19,48 +19,213 @@
 #ifndef __BACKEND_H__
 #define __BACKEND_H__
 
+#include "list.h"
+
 #define PATH_BUFSZ 1024
 #define TOKEN_BUFSZ 64
+#define CACHELINE_SZ 64
 
 #define BACKEND_DEVICE_MAX 16
+#define TEARDOWN_THREADS_MAX 32
+#define SYNC_RETRY_MS 100
 
 #define MAGIC_STRING "libxenbackend:"
 
+/* A backend node as last written, see wc.c */
+struct xen_wc_entry
+{
+    LIST_ENTRY(struct xen_wc_entry) link;
+    char                        *node;
+    char                        *val;
+    int                         dirty;
+};
+
+LIST_HEAD(xen_wc_list, struct xen_wc_entry);
+
+/* Sits in one of the timer wheel's slots while armed, see timer.c */
+struct xen_timer
+{
+    LIST_ENTRY(struct xen_timer) link;
+    unsigned long long          expires;        /* in ticks */
+    xen_timer_fn_t              fn;
+    void                        *arg;
+    int                         level;
+    int                         armed;
+    int                         alloced;        /* by backend_timer_add() */
+};
+
+LIST_HEAD(xen_timer_list, struct xen_timer);
+
+struct xen_poll
+{
+    unsigned long long          window_ns;
+    int                         (*pending)(xen_device_t xendev);
+    struct xen_poll_stats       stats;
+};
+
+/* Nodes the library itself tracks, see keys.c */
+#define KEY_ONLINE      (1 << 0)
+#define KEY_STATE       (1 << 1)
+#define KEY_PROTOCOL    (1 << 2)
+#define KEY_RING        (1 << 3)
+#define KEY_EVTCHN      (1 << 4)
+
+struct xen_key
+{
+    const char                  *name;
+    unsigned int                hash;
+    int                         id;     /* backend's key ID, or -1 */
+    int                         flags;  /* KEY_* */
+};
+
+/* Open addressed, power of two sized */
+struct xen_keytab
+{
+    struct xen_key              *slots;
+    unsigned int                mask;
+    unsigned int                count;
+};
+
+/*
+ * Per-feature state of a device, out of the way of the event path. One
+ * per device slot, allocated with the backend and kept for its
+ * lifetime, so armed timers and cached writes outlive the device.
+ */
+struct xen_device_cold
+{
+    /* The ring mapped last, and where, for backend_checkpoint() */
+    void                        *ring;
+    int                         ring_mfn;
+    int                         remote_port;
+
+    /* Auto-connect, see connect.c */
+    int                         fe_ring_ref;    /* -1 if not known */
+    int                         fe_evtchn;
+    void                        *auto_ring;
+    int                         auto_ring_mfn;
+    int                         auto_bound;     /* port bound by it */
+    unsigned long long          handshake_ts;
+
+    /* Event scheduling, see sched.c */
+    int                         weight;
+    int                         deficit;
+
+    struct xen_wc_list          wc;             /* see wc.c */
+
+    /* Quiesce, see quiesce.c */
+    int                         quiesce_pending;
+    struct checkpoint           *snapshot;
+
+    /* Handshake timeout, see backend_set_state_timeout() */
+    struct xen_timer            timer;
+    enum xenbus_state           timer_state;
+    int                         reclaimed;
+};
+
+/*
+ * Everything backend_evtchn_handler() looks at, queueing the event with
+ * sched_enqueue() included, sits in the first cache line; the state
+ * machine's fields and the strings only the control path needs fill the
+ * second. The rest is in the slot's struct xen_device_cold. The backend
+ * path of a device is not stored, it is derived from backend->path and
+ * devid when needed (see xs_be_path()).
+ */
 struct xen_device
 {
     xen_device_t		dev;
+    struct xen_backend          *backend;
+    xc_evtchn                   *evtchndev;
+    struct xen_poll             *poll;  /* busy polling, see poll.c */
+    struct xen_device           *sched_next;    /* see sched.c */
+    unsigned long long          sched_ts;
+    int                         local_port;
+    int                         devid;
+    int                         prio;
+    unsigned char               queued;
+    unsigned char               requeue;
+    unsigned char               quiesced;       /* see quiesce.c */
+    unsigned char               quiesce_masked;
 
     enum xenbus_state           be_state;
     enum xenbus_state           fe_state;
+    int                         online;
 
-    char                        *be;
+    /* cold */
+    int                         fe_len;
     char                        *fe;
-
     char                        *protocol;
 
-    struct xen_backend          *backend;
+    struct xengntdev_handle     *gnttabdev;     /* opened on first use */
+    struct xen_cpuset           *affinity;      /* see affinity.c */
+    struct xen_device_cold      *cold;
 
-    int                         online;
-
-    xc_evtchn                   *evtchndev;
-    int                         local_port;
-};
+    /* Being torn down off the application's thread, see release_backends() */
+    int                         detached;
+} __attribute__ ((aligned (CACHELINE_SZ)));
 
 struct xen_backend
 {
     struct xen_backend_ops      *ops;
     int                         domid;
+    int                         path_len;
+    backend_private_t           priv;
+    struct xs_handle            *xsh;
+
+    struct xen_device           devices[BACKEND_DEVICE_MAX];
+    struct xen_device_cold      *cold;          /* one per devices[] slot */
+
+    /* cold */
     const char                  *type;
+    char                        *path;
 
-    backend_private_t           priv;
+    int                         thread_safe;    /* see release_backends() */
 
-    char                        path[PATH_BUFSZ];
-    int                         path_len;
-    char                        token[TOKEN_BUFSZ];
+    struct xen_keytab           be_keys;
+    struct xen_keytab           fe_keys;
+    const struct xen_backend_keys *keys;
 
-    struct xen_device           devices[BACKEND_DEVICE_MAX];
+    int                         auto_connect;
+    struct xen_connect_stats    connect_stats;
+
+    int                         (*inflight)(xen_device_t dev);
+    struct xen_quiesce_stats    quiesce_stats;
+
+    /* Initial scan of backend_register_async() */
+    int                         syncing;
+    int                         sync_listed;
+    unsigned int                sync_pending;   /* devids still to scan */
+    struct xen_timer            sync_timer;
+    xen_backend_synced_t        synced;
+
+    int                         wc;
+    int                         wc_dirty;
+    struct xen_write_stats      wc_stats;
+
+    LIST_ENTRY(struct xen_backend) link;
 };
 
+LIST_HEAD(xen_backend_list, struct xen_backend);
+
+/* A device as recorded by backend_checkpoint(), see checkpoint.c */
+struct checkpoint
+{
+    LIST_ENTRY(struct checkpoint) link;
+
+    char                        type[TOKEN_BUFSZ];
+    int                         domid;
+    int                         devid;
+    int                         be_state;
+    int                         fe_state;
+    int                         ring_mfn;
+    int                         remote_port;
+};
+
+LIST_HEAD(checkpoint_list, struct checkpoint);
+
 extern struct xs_handle *xs_handle;
+extern xc_interface *xc_handle;
+extern int self_domid;
+extern struct xen_backend_list backends;
+extern pthread_mutex_t backends_lock;
 
 #endif /* __BACKEND_H__ */
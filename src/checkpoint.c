@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Daemon restart without renegotiation.
+ *
+ * A daemon about to be restarted calls backend_checkpoint() and exits
+ * without releasing its backends. The new instance calls
+ * backend_restore() between backend_init() and backend_register(); a
+ * device found Connected in xenstore that matches a checkpointed entry
+ * is then adopted (see try_adopt() in state.c) instead of being reset
+ * to Initialising.
+ *
+ * The file has one line per device:
+ *
+ *   <type> <domid> <devid> <be state> <fe state> <page-ref> <remote port>
+ *
+ * with -1 for a page-ref or port the device did not have.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+static struct checkpoint_list restored = LIST_HEAD_INITIALIZER;
+static pthread_mutex_t restored_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void checkpoint_record(struct xen_device *xendev,
+                              struct checkpoint *cp)
+{
+    struct xen_backend *xenback = xendev->backend;
+
+    snprintf(cp->type, sizeof (cp->type), "%s", xenback->type);
+    cp->domid = xenback->domid;
+    cp->devid = xendev->devid;
+    cp->be_state = xendev->be_state;
+    cp->fe_state = xendev->fe_state;
+    cp->ring_mfn = xendev->cold->ring ? xendev->cold->ring_mfn : -1;
+    cp->remote_port = xendev->local_port != -1 ? xendev->cold->remote_port : -1;
+}
+
+/* The state backend_resume() checks a quiesced device against */
+INTERNAL struct checkpoint *
+checkpoint_snapshot(struct xen_device *xendev)
+{
+    struct checkpoint *cp;
+
+    cp = malloc(sizeof (*cp));
+    if (cp)
+        checkpoint_record(xendev, cp);
+    return cp;
+}
+
+EXTERNAL int
+backend_checkpoint(const char *path)
+{
+    char tmp[PATH_BUFSZ];
+    struct xen_backend *xenback;
+    struct checkpoint cp;
+    FILE *f;
+    int i;
+
+    snprintf(tmp, sizeof (tmp), "%s.tmp", path);
+    f = fopen(tmp, "w");
+    if (!f)
+        return -1;
+
+    pthread_mutex_lock(&backends_lock);
+    LIST_FOREACH(xenback, &backends, link) {
+        for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+            if (!xenback->devices[i].dev)
+                continue;
+
+            checkpoint_record(&xenback->devices[i], &cp);
+            fprintf(f, "%s %d %d %d %d %d %d\n", cp.type, cp.domid,
+                    cp.devid, cp.be_state, cp.fe_state, cp.ring_mfn,
+                    cp.remote_port);
+        }
+    }
+    pthread_mutex_unlock(&backends_lock);
+
+    if (fflush(f) || fsync(fileno(f))) {
+        fclose(f);
+        unlink(tmp);
+        return -1;
+    }
+    fclose(f);
+
+    return rename(tmp, path);
+}
+
+/* Returns the number of devices read from path, or -1 */
+EXTERNAL int
+backend_restore(const char *path)
+{
+    char fmt[32];
+    struct checkpoint *cp;
+    FILE *f;
+    int n = 0;
+
+    f = fopen(path, "r");
+    if (!f)
+        return -1;
+
+    snprintf(fmt, sizeof (fmt), "%%%ds %%d %%d %%d %%d %%d %%d",
+             TOKEN_BUFSZ - 1);
+
+    for (;;) {
+        cp = calloc(1, sizeof (*cp));
+        if (!cp)
+            break;
+
+        if (fscanf(f, fmt, cp->type, &cp->domid, &cp->devid,
+                   &cp->be_state, &cp->fe_state, &cp->ring_mfn,
+                   &cp->remote_port) != 7) {
+            free(cp);
+            break;
+        }
+        if (cp->devid < 0 || cp->devid >= BACKEND_DEVICE_MAX) {
+            free(cp);
+            continue;
+        }
+
+        pthread_mutex_lock(&restored_lock);
+        LIST_INSERT_HEAD(&restored, cp, link);
+        pthread_mutex_unlock(&restored_lock);
+        n++;
+    }
+
+    fclose(f);
+    return n;
+}
+
+/*
+ * Find (and unlink) the checkpoint entry for xendev, if it was
+ * checkpointed Connected. The caller frees it.
+ */
+INTERNAL struct checkpoint *
+checkpoint_take(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    struct checkpoint *cp;
+
+    pthread_mutex_lock(&restored_lock);
+    LIST_FOREACH(cp, &restored, link) {
+        if (cp->domid == xenback->domid && cp->devid == xendev->devid &&
+            !strcmp(cp->type, xenback->type)) {
+            LIST_REMOVE(cp, link);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&restored_lock);
+
+    if (cp && cp->be_state != XenbusStateConnected) {
+        free(cp);
+        cp = NULL;
+    }
+    return cp;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Auto-connect.
+ *
+ * With backend_set_auto_connect(), the library follows the frontend's
+ * page-ref and event-channel nodes as their watch events come in. While
+ * the device waits in InitWait, it maps the ring and binds the port as
+ * soon as their values arrive, overlapping that with the rest of the
+ * frontend's setup; whatever is still missing is done once the
+ * frontend is Initialised, before calling the connect callback. By
+ * then no xenstore request is left to make: backend_map_shared_page()
+ * and backend_bind_evtchn() called from the callback return what is
+ * already set up, and backend_ring() gives the ring directly. Both are
+ * released again after the disconnect callback, or if connect fails.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+static void auto_release_ring(struct xen_device *xendev)
+{
+    if (!xendev->cold->auto_ring)
+        return;
+
+    if (xendev->cold->auto_ring == xendev->cold->ring)
+        xendev->cold->ring = NULL;
+    munmap(xendev->cold->auto_ring, XC_PAGE_SIZE);
+    xendev->cold->auto_ring = NULL;
+}
+
+static void auto_unbind(struct xen_device *xendev)
+{
+    if (!xendev->cold->auto_bound)
+        return;
+
+    xendev->cold->auto_bound = 0;
+    backend_unbind_evtchn(xendev->backend, xendev->devid);
+}
+
+/* Map the ring at fe_ring_ref, unless it already is */
+static int auto_map(struct xen_device *xendev)
+{
+    void *page;
+
+    if (xendev->cold->auto_ring) {
+        if (xendev->cold->auto_ring_mfn == xendev->cold->fe_ring_ref)
+            return 0;
+        auto_release_ring(xendev);
+    }
+
+    page = backend_map_shared_page(xendev->backend, xendev->devid);
+    if (!page)
+        return -1;
+    xendev->cold->auto_ring = page;
+    xendev->cold->auto_ring_mfn = xendev->cold->fe_ring_ref;
+    return 0;
+}
+
+/* Bind the port at fe_evtchn, unless it already is */
+static int auto_bind(struct xen_device *xendev)
+{
+    if (xendev->cold->auto_bound) {
+        if (xendev->cold->remote_port == xendev->cold->fe_evtchn)
+            return 0;
+        auto_unbind(xendev);
+    }
+
+    if (backend_bind_evtchn(xendev->backend, xendev->devid) == -1)
+        return -1;
+    xendev->cold->auto_bound = 1;
+    return 0;
+}
+
+/*
+ * The frontend wrote its page-ref or event-channel: map or bind it now
+ * if the device is waiting for the frontend, rather than once it is
+ * Initialised. Failures are left for auto_connect() to retry.
+ */
+INTERNAL void
+auto_prefetch(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    unsigned long long start;
+
+    if (!xenback->auto_connect || xendev->be_state != XenbusStateInitWait)
+        return;
+
+    start = now_ns();
+    if (xendev->cold->fe_ring_ref != -1)
+        auto_map(xendev);
+    if (xendev->cold->fe_evtchn != -1)
+        auto_bind(xendev);
+    xenback->connect_stats.prefetch_ns += now_ns() - start;
+}
+
+INTERNAL int
+auto_connect(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    unsigned long long start = now_ns();
+    int val;
+
+    /* Nodes written before auto-connect was enabled */
+    if (xendev->cold->fe_ring_ref == -1) {
+        if (xs_read_fe_int(xendev, "page-ref", &val))
+            goto fail;
+        xendev->cold->fe_ring_ref = val;
+    }
+    if (xendev->cold->fe_evtchn == -1) {
+        if (xs_read_fe_int(xendev, "event-channel", &val))
+            goto fail;
+        xendev->cold->fe_evtchn = val;
+    }
+
+    if (auto_map(xendev))
+        goto fail;
+    if (auto_bind(xendev))
+        goto fail_bind;
+
+    xenback->connect_stats.prefetch_ns += now_ns() - start;
+    PROBE3(auto_connect, xenback->domid, xendev->devid, xendev->local_port);
+    return 0;
+
+fail_bind:
+    auto_release_ring(xendev);
+fail:
+    xenback->connect_stats.prefetch_ns += now_ns() - start;
+    return -1;
+}
+
+/*
+ * Forget the frontend's page-ref and port: the next connection gets
+ * new ones, which must not be mistaken for these before their watch
+ * events come in.
+ */
+INTERNAL void
+auto_forget(struct xen_device *xendev)
+{
+    xendev->cold->fe_ring_ref = -1;
+    xendev->cold->fe_evtchn = -1;
+}
+
+INTERNAL void
+auto_disconnect(struct xen_device *xendev)
+{
+    auto_release_ring(xendev);
+    auto_unbind(xendev);
+    auto_forget(xendev);
+}
+
+/* The device just went Connected */
+INTERNAL void
+connect_done(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    struct xen_connect_stats *st = &xenback->connect_stats;
+    unsigned long long d = now_ns() - xendev->cold->handshake_ts;
+
+    st->connects++;
+    st->total_ns += d;
+    if (d > st->max_ns)
+        st->max_ns = d;
+
+    /*
+     * Events on a port auto-connect bound early were dropped until now
+     * (see backend_evtchn_handler()): go through the ring once for
+     * whatever the frontend notified in the meantime.
+     */
+    if (xendev->cold->auto_bound) {
+        if (sched_enabled())
+            sched_enqueue(xendev);
+        else if (xenback->ops->event)
+            xenback->ops->event(xendev->dev);
+    }
+}
+
+/*
+ * Have the library map the ring and bind the event channel of the
+ * backend's devices before their connect callback. Call before the
+ * frontends connect, the values of the nodes being picked up from
+ * their watch events.
+ */
+EXTERNAL int
+backend_set_auto_connect(xen_backend_t xenback, int enable)
+{
+    if (enable && keys_add_auto_connect(xenback))
+        return -1;
+
+    xenback->auto_connect = !!enable;
+    return 0;
+}
+
+/* The ring auto-connect mapped for the device, NULL if none */
+EXTERNAL void *
+backend_ring(xen_backend_t xenback, int devid)
+{
+    return xenback->cold[devid].auto_ring;
+}
+
+EXTERNAL void
+backend_connect_stats(xen_backend_t xenback, struct xen_connect_stats *stats)
+{
+    *stats = xenback->connect_stats;
+}
@@ -17,6 +17,10 @@
  */
 
 /* xs.c */
+int backend_read(xen_backend_t xenback, int devid, const char *node, char *buf, unsigned int len);
+int frontend_read(xen_backend_t xenback, int devid, const char *node, char *buf, unsigned int len);
+int backend_read_int(xen_backend_t xenback, int devid, const char *node, int *ival);
+int frontend_read_int(xen_backend_t xenback, int devid, const char *node, int *ival);
 int backend_print(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
 int backend_scan(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
 int frontend_scan(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
@@ -25,8 +29,11 @@ int frontend_scan(xen_backend_t xenback, int devid, const char *node, const char
 int backend_init(int backend_domid);
 int backend_close(void);
 xen_backend_t backend_register(const char *type, int domid, struct xen_backend_ops *ops, backend_private_t priv);
+xen_backend_t backend_register_async(const char *type, int domid, struct xen_backend_ops *ops, backend_private_t priv, xen_backend_synced_t synced);
 void backend_release(xen_backend_t xenback);
-void backend_xenstore_handler(void *unused);
+void backend_set_thread_safe(xen_backend_t xenback, int safe);
+int backend_release_domain(int domid, unsigned int nthreads, unsigned long long *elapsed_ns);
+void backend_xenstore_handler(void *priv);
 int backend_xenstore_fd(void);
 int backend_bind_evtchn(xen_backend_t xenback, int devid);
 void backend_unbind_evtchn(xen_backend_t xenback, int devid);
@@ -35,3 +42,61 @@ void *backend_evtchn_priv(xen_backend_t xenback, int devid);
 void backend_evtchn_handler(void *priv);
 void *backend_map_shared_page(xen_backend_t xenback, int devid);
 void backend_unmap_shared_page(xen_backend_t xenback, int devid, void *page);
+/* keys.c */
+int backend_register_keys(xen_backend_t xenback, const struct xen_backend_keys *keys);
+/* schema.c */
+int backend_bind(xen_backend_t xenback, int devid, const struct xen_field *schema, void *obj, unsigned long long *changed);
+int frontend_bind(xen_backend_t xenback, int devid, const struct xen_field *schema, void *obj, unsigned long long *changed);
+/* poll.c */
+int backend_set_busy_poll(xen_backend_t xenback, int devid, unsigned int window_us, int (*pending)(xen_device_t xendev));
+int backend_busy_poll_stats(xen_backend_t xenback, int devid, struct xen_poll_stats *stats);
+/* gnttab.c */
+int backend_grant_copy(xen_backend_t xenback, int devid, struct xen_grant_copy *segs, unsigned int count);
+/* checkpoint.c */
+int backend_checkpoint(const char *path);
+int backend_restore(const char *path);
+/* sched.c */
+void backend_set_scheduling(int enable);
+int backend_set_priority(xen_backend_t xenback, int devid, int prio, unsigned int weight);
+void backend_requeue_event(xen_backend_t xenback, int devid);
+int backend_pending_events(void);
+int backend_run_events(unsigned int budget);
+int backend_sched_stats(int prio, struct xen_sched_stats *stats);
+/* affinity.c */
+void backend_set_affinity_policy(enum xen_affinity_policy p);
+int backend_set_affinity(xen_backend_t xenback, int devid, const struct xen_cpuset *set);
+int backend_get_affinity(xen_backend_t xenback, int devid, struct xen_cpuset *set);
+int backend_apply_affinity(xen_backend_t xenback, int devid);
+void *backend_alloc_local(xen_backend_t xenback, int devid, unsigned long size);
+void backend_free_local(void *p, unsigned long size);
+/* wc.c */
+int backend_set_write_combining(xen_backend_t xenback, int enable);
+void backend_flush(xen_backend_t xenback);
+void backend_write_stats(xen_backend_t xenback, struct xen_write_stats *stats);
+/* timer.c */
+int backend_set_state_timeout(int state, unsigned int ms);
+xen_timer_t backend_timer_add(unsigned int ms, xen_timer_fn_t fn, void *arg);
+void backend_timer_cancel(xen_timer_t t);
+int backend_timer_fd(void);
+int backend_timer_timeout(void);
+void backend_timer_handler(void);
+/* fds.c */
+int backend_set_fd_notify(xen_fd_notify_t fn, void *opaque);
+/* xlate.c */
+int backend_ring_abi(xen_backend_t xenback, int devid);
+void backend_xlate_set_simd(int enable);
+xen_xlate_t backend_xlate_create(const struct xen_ring_field *fields, unsigned int size32, unsigned int size64, enum xen_ring_abi abi, enum xen_xlate_dir dir);
+void backend_xlate_free(xen_xlate_t x);
+int backend_xlate_simd(xen_xlate_t x);
+void backend_xlate(xen_xlate_t x, void *dst, const void *src, unsigned int n);
+/* connect.c */
+int backend_set_auto_connect(xen_backend_t xenback, int enable);
+void *backend_ring(xen_backend_t xenback, int devid);
+void backend_connect_stats(xen_backend_t xenback, struct xen_connect_stats *stats);
+/* quiesce.c */
+void backend_set_inflight(xen_backend_t xenback, int (*fn)(xen_device_t dev));
+int backend_quiesce(xen_backend_t xenback, unsigned int timeout_ms, xen_quiesced_t done, void *opaque);
+int backend_quiesce_domain(int domid, unsigned int timeout_ms, xen_quiesced_t done, void *opaque);
+int backend_resume(xen_backend_t xenback);
+int backend_resume_domain(int domid);
+void backend_quiesce_stats(xen_backend_t xenback, struct xen_quiesce_stats *stats);
@@ -0,0 +1,130 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Telling the application's event loop which fds to poll.
+ *
+ * Once backend_set_fd_notify() is called, every change to the set is
+ * reported as it happens, so a loop built on epoll, libevent or libuv
+ * can keep one registration per fd instead of rebuilding its set:
+ *
+ *  - the xenstore connection is added by backend_init() and removed
+ *    by backend_close();
+ *  - the event channel fd of a device is added, with no events, when
+ *    the device appears, changed to XEN_FD_READ when its port is bound
+ *    and back when unbound or quiesced, and removed when the device
+ *    goes away;
+ *  - the timer fd is added when backend_timer_fd() creates it, and
+ *    removed by backend_close().
+ *
+ * The callback is only called from the thread the application runs
+ * the library from: backend_release_domain() removes the fds of the
+ * devices it releases before handing them to its threads. It is never
+ * called with backends_lock held, so it may call into the library.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+static xen_fd_notify_t fd_notify_fn = NULL;
+static void *fd_notify_opaque = NULL;
+
+static void fd_notify(enum xen_fd_op op, int fd, int events,
+                      void (*handler)(void *), void *priv)
+{
+    struct xen_fd_event ev;
+
+    if (!fd_notify_fn || fd == -1)
+        return;
+
+    ev.op = op;
+    ev.fd = fd;
+    ev.events = events;
+    ev.handler = handler;
+    ev.priv = priv;
+
+    PROBE3(fd_notify, op, fd, events);
+    fd_notify_fn(&ev, fd_notify_opaque);
+}
+
+INTERNAL void
+fd_notify_device(struct xen_device *xendev, enum xen_fd_op op)
+{
+    if (!xendev->evtchndev || xendev->detached)
+        return;
+
+    fd_notify(op, xc_evtchn_fd(xendev->evtchndev),
+              xendev->local_port != -1 && !xendev->quiesced ? XEN_FD_READ : 0,
+              backend_evtchn_handler, xendev);
+}
+
+INTERNAL void
+fd_notify_xenstore(enum xen_fd_op op)
+{
+    fd_notify(op, backend_xenstore_fd(), XEN_FD_READ,
+              backend_xenstore_handler, NULL);
+}
+
+static void timer_fd_handler(void *priv)
+{
+    (void)priv;
+    backend_timer_handler();
+}
+
+INTERNAL void
+fd_notify_timer(int fd, enum xen_fd_op op)
+{
+    fd_notify(op, fd, XEN_FD_READ, timer_fd_handler, NULL);
+}
+
+/*
+ * Report changes to the set of fds to poll through fn(ev, opaque).
+ * The fds already in use are reported as added straight away. NULL
+ * stops the notifications. Returns -1 if out of memory, with nothing
+ * reported and the notifications left off.
+ */
+EXTERNAL int
+backend_set_fd_notify(xen_fd_notify_t fn, void *opaque)
+{
+    struct xen_device **devs, **d;
+    fd_notify_fn = NULL;
+    fd_notify_opaque = NULL;
+    if (!fn)
+        return 0;
+
+    devs = collect_devices(NULL, -1);
+    if (!devs)
+        return -1;
+
+    fd_notify_fn = fn;
+    fd_notify_opaque = opaque;
+
+    if (xs_handle)
+        fd_notify_xenstore(XEN_FD_ADD);
+
+    fd_notify_timer(timer_fd_current(), XEN_FD_ADD);
+
+    /* The callback may release backends as it goes */
+    for (d = devs; *d; d++) {
+        if (device_live(*d))
+            fd_notify_device(*d, XEN_FD_ADD);
+    }
+    free(devs);
+
+    return 0;
+}
@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "project.h"
+#include "backend.h"
+
+#ifdef HAVE_XENGNTTAB_GRANT_COPY
+# include <xengnttab.h>
+# include <xen/grant_table.h>
+#endif
+
+/* Segments copied from the stack; more than that are allocated */
+#define GRANT_COPY_STACK 64
+
+INTERNAL void
+device_gnttab_close(struct xen_device *xendev)
+{
+    if (xendev->gnttabdev) {
+#ifdef HAVE_XENGNTTAB_GRANT_COPY
+        xengnttab_close(xendev->gnttabdev);
+#endif
+        xendev->gnttabdev = NULL;
+    }
+}
+
+#ifdef HAVE_XENGNTTAB_GRANT_COPY
+static xengnttab_handle *device_gnttab(struct xen_device *xendev)
+{
+    if (!xendev->gnttabdev)
+        xendev->gnttabdev = xengnttab_open(NULL, 0);
+    return xendev->gnttabdev;
+}
+
+static int seg_valid(const struct xen_grant_copy *seg)
+{
+    return seg->offset < XC_PAGE_SIZE && seg->len != 0 &&
+           seg->len <= XC_PAGE_SIZE - seg->offset;
+}
+#endif
+
+/*
+ * Copy count segments between local buffers and pages granted by the
+ * frontend, all in one hypercall. The status of each segment is
+ * returned in segs[i].status. Returns -1 (with errno set) if the
+ * copies could not be issued at all, every segment's status then
+ * being an error; 0 otherwise.
+ */
+EXTERNAL int
+backend_grant_copy(xen_backend_t xenback, int devid,
+                   struct xen_grant_copy *segs, unsigned int count)
+{
+#ifdef HAVE_XENGNTTAB_GRANT_COPY
+    struct xen_device *xendev = &xenback->devices[devid];
+    xengnttab_grant_copy_segment_t stack[GRANT_COPY_STACK];
+    xengnttab_grant_copy_segment_t *batch = stack;
+    xengnttab_handle *xgt;
+    struct xen_grant_copy *seg;
+    unsigned int i, queued = 0;
+    int rc = -1;
+
+    xgt = device_gnttab(xendev);
+    if (!xgt)
+        goto fail;
+
+    if (count > GRANT_COPY_STACK) {
+        batch = malloc(count * sizeof (*batch));
+        if (!batch) {
+            batch = stack;
+            goto fail;
+        }
+    }
+
+    for (i = 0, seg = segs; i < count; i++, seg++) {
+        xengnttab_grant_copy_segment_t *xseg = &batch[queued];
+
+        if (!seg_valid(seg)) {
+            seg->status = GNTST_general_error;
+            continue;
+        }
+
+        memset(xseg, 0, sizeof (*xseg));
+        if (seg->dir == XEN_GRANT_COPY_FROM_GUEST) {
+            xseg->source.foreign.ref = seg->ref;
+            xseg->source.foreign.offset = seg->offset;
+            xseg->source.foreign.domid = xenback->domid;
+            xseg->dest.virt = seg->buf;
+            xseg->flags = GNTCOPY_source_gref;
+        } else {
+            xseg->source.virt = seg->buf;
+            xseg->dest.foreign.ref = seg->ref;
+            xseg->dest.foreign.offset = seg->offset;
+            xseg->dest.foreign.domid = xenback->domid;
+            xseg->flags = GNTCOPY_dest_gref;
+        }
+        xseg->len = seg->len;
+        queued++;
+    }
+
+    PROBE3(grant_copy, xenback->domid, devid, queued);
+
+    if (queued && xengnttab_grant_copy(xgt, queued, batch))
+        goto fail;
+
+    /* Hand the statuses back, skipping the segments we rejected */
+    for (i = 0, queued = 0, seg = segs; i < count; i++, seg++) {
+        if (seg_valid(seg))
+            seg->status = batch[queued++].status;
+    }
+    rc = 0;
+    goto out;
+
+fail:
+    for (i = 0; i < count; i++)
+        segs[i].status = GNTST_general_error;
+out:
+    if (batch != stack) {
+        int saved = errno;
+
+        free(batch);
+        errno = saved;
+    }
+    return rc;
+#else
+    (void)xenback;
+    (void)devid;
+    (void)segs;
+    (void)count;
+
+    errno = ENOSYS;
+    return -1;
+#endif
+}
@@ -0,0 +1,198 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Resolution of changed xenstore nodes to small integer key IDs.
+ *
+ * Each backend has one table for its backend nodes and one for its
+ * frontend nodes, holding the nodes the library tracks itself (online,
+ * state, protocol) and, once backend_register_keys() was called, the
+ * ones the backend asked for. A lookup is one hash of the node name
+ * and, on a hit, one strcmp to confirm it.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+static unsigned int key_hash(const char *name)
+{
+    unsigned int h = 2166136261u;
+
+    while (*name) {
+        h ^= (unsigned char)*name++;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static int keytab_grow(struct xen_keytab *tab)
+{
+    struct xen_key *old = tab->slots;
+    unsigned int old_size = old ? tab->mask + 1 : 0;
+    unsigned int size = old_size ? old_size * 2 : 8;
+    unsigned int i;
+
+    tab->slots = calloc(size, sizeof (*tab->slots));
+    if (!tab->slots) {
+        tab->slots = old;
+        return -1;
+    }
+    tab->mask = size - 1;
+
+    for (i = 0; i < old_size; i++) {
+        unsigned int j;
+
+        if (!old[i].name)
+            continue;
+        for (j = old[i].hash & tab->mask; tab->slots[j].name;
+             j = (j + 1) & tab->mask)
+            ;
+        tab->slots[j] = old[i];
+    }
+    free(old);
+
+    return 0;
+}
+
+static struct xen_key *keytab_lookup(struct xen_keytab *tab,
+                                     const char *name)
+{
+    unsigned int h, i;
+
+    if (!tab->slots || !name)
+        return NULL;
+
+    h = key_hash(name);
+    for (i = h & tab->mask; tab->slots[i].name; i = (i + 1) & tab->mask) {
+        if (tab->slots[i].hash == h && !strcmp(tab->slots[i].name, name))
+            return &tab->slots[i];
+    }
+    return NULL;
+}
+
+/* Add name, or merge id/flags into an existing entry for it */
+static int keytab_add(struct xen_keytab *tab, const char *name, int id,
+                      int flags)
+{
+    struct xen_key *key;
+    unsigned int h, i;
+
+    key = keytab_lookup(tab, name);
+    if (key) {
+        if (id != -1)
+            key->id = id;
+        key->flags |= flags;
+        return 0;
+    }
+
+    /* Keep the load factor under 1/2 */
+    if (!tab->slots || (tab->count + 1) * 2 > tab->mask + 1) {
+        if (keytab_grow(tab))
+            return -1;
+    }
+
+    h = key_hash(name);
+    for (i = h & tab->mask; tab->slots[i].name; i = (i + 1) & tab->mask)
+        ;
+    tab->slots[i].name = name;
+    tab->slots[i].hash = h;
+    tab->slots[i].id = id;
+    tab->slots[i].flags = flags;
+    tab->count++;
+
+    return 0;
+}
+
+static void keytab_free(struct xen_keytab *tab)
+{
+    free(tab->slots);
+    tab->slots = NULL;
+    tab->mask = 0;
+    tab->count = 0;
+}
+
+INTERNAL struct xen_key *
+key_lookup_be(struct xen_backend *xenback, const char *node)
+{
+    return keytab_lookup(&xenback->be_keys, node);
+}
+
+INTERNAL struct xen_key *
+key_lookup_fe(struct xen_backend *xenback, const char *node)
+{
+    return keytab_lookup(&xenback->fe_keys, node);
+}
+
+INTERNAL int
+keys_init(struct xen_backend *xenback)
+{
+    if (keytab_add(&xenback->be_keys, "online", -1, KEY_ONLINE) ||
+        keytab_add(&xenback->fe_keys, "state", -1, KEY_STATE) ||
+        keytab_add(&xenback->fe_keys, "protocol", -1, KEY_PROTOCOL)) {
+        keys_release(xenback);
+        return -1;
+    }
+    return 0;
+}
+
+/* Track the nodes auto-connect needs, see connect.c */
+INTERNAL int
+keys_add_auto_connect(struct xen_backend *xenback)
+{
+    if (keytab_add(&xenback->fe_keys, "page-ref", -1, KEY_RING) ||
+        keytab_add(&xenback->fe_keys, "event-channel", -1, KEY_EVTCHN))
+        return -1;
+    return 0;
+}
+
+INTERNAL void
+keys_release(struct xen_backend *xenback)
+{
+    keytab_free(&xenback->be_keys);
+    keytab_free(&xenback->fe_keys);
+}
+
+/*
+ * Restrict backend_changed/frontend_changed notifications to the nodes
+ * listed in keys. Changes to any other node are dropped before their
+ * value is read. The arrays (and the strings in them) must outlive the
+ * backend.
+ */
+EXTERNAL int
+backend_register_keys(xen_backend_t xenback,
+                      const struct xen_backend_keys *keys)
+{
+    int i;
+
+    if (keys->backend) {
+        for (i = 0; keys->backend[i]; i++) {
+            if (keytab_add(&xenback->be_keys, keys->backend[i], i, 0))
+                return -1;
+        }
+    }
+
+    if (keys->frontend) {
+        for (i = 0; keys->frontend[i]; i++) {
+            if (keytab_add(&xenback->fe_keys, keys->frontend[i], i, 0))
+                return -1;
+        }
+    }
+
+    xenback->keys = keys;
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Adaptive busy polling.
+ *
+ * Once a device with a polling window gets an event, the handler keeps
+ * spinning on the backend's ring (through its pending() callback) and on
+ * the event channel for up to window_ns after the last piece of work,
+ * instead of returning to the application's poll loop and paying for
+ * a wakeup on the next event. The application's loop does not run
+ * while a device spins, so windows should stay short.
+ */
+
+#include <poll.h>
+#include <time.h>
+
+#include "project.h"
+#include "backend.h"
+
+/* Check the event channel fd every so many spins */
+#define POLL_FD_INTERVAL 32
+
+static inline void cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__ ("pause" ::: "memory");
+#else
+    __asm__ __volatile__ ("" ::: "memory");
+#endif
+}
+
+INTERNAL unsigned long long
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int evtchn_ready(struct xen_device *xendev)
+{
+    struct pollfd pfd;
+    int port;
+
+    pfd.fd = xc_evtchn_fd(xendev->evtchndev);
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 0) != 1)
+        return 0;
+
+    port = xc_evtchn_pending(xendev->evtchndev);
+    if (port != xendev->local_port)
+        return 0;
+    xc_evtchn_unmask(xendev->evtchndev, port);
+
+    return 1;
+}
+
+static void account_gap(struct xen_poll_stats *stats,
+                        unsigned long long gap_ns)
+{
+    unsigned long long us = gap_ns / 1000;
+    int b = 0;
+
+    while (us > 1 && b < XEN_POLL_GAP_BUCKETS - 1) {
+        us >>= 1;
+        b++;
+    }
+    stats->gap_us[b]++;
+}
+
+/* Called by backend_evtchn_handler() after dispatching an event */
+INTERNAL void
+busy_poll(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    struct xen_poll *p = xendev->poll;
+    unsigned long long start, last, now;
+    unsigned int spins = 0;
+
+    start = last = now = now_ns();
+    p->stats.wakeups++;
+
+    for (;;) {
+        int work = 0;
+
+        /* Quiesced from a callback: dispatch stops here */
+        if (xendev->quiesced)
+            break;
+
+        if (p->pending && p->pending(xendev->dev))
+            work = 1;
+        else if (++spins % POLL_FD_INTERVAL == 0 || !p->pending)
+            work = evtchn_ready(xendev);
+
+        now = now_ns();
+        if (work) {
+            account_gap(&p->stats, now - last);
+            p->stats.polled++;
+            if (xenback->ops->event)
+                xenback->ops->event(xendev->dev);
+            /* The event handler may have turned polling off */
+            if (xendev->poll != p)
+                return;
+            last = now_ns();
+            continue;
+        }
+
+        if (now - last >= p->window_ns) {
+            p->stats.expired++;
+            break;
+        }
+        cpu_relax();
+    }
+
+    p->stats.spin_ns += now - start;
+    PROBE4(busy_poll, xenback->domid, xendev->devid, p->stats.polled,
+           now - start);
+}
+
+/*
+ * Opt a device in (window_us > 0) or out of busy polling. pending is
+ * optional; when given it should cheaply report whether the shared
+ * ring has unconsumed work, e.g. RING_HAS_UNCONSUMED_REQUESTS().
+ */
+EXTERNAL int
+backend_set_busy_poll(xen_backend_t xenback, int devid,
+                      unsigned int window_us,
+                      int (*pending)(xen_device_t xendev))
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (window_us == 0) {
+        free(xendev->poll);
+        xendev->poll = NULL;
+        return 0;
+    }
+
+    if (!xendev->poll) {
+        xendev->poll = calloc(1, sizeof (*xendev->poll));
+        if (!xendev->poll)
+            return -1;
+    }
+    xendev->poll->window_ns = window_us * 1000ULL;
+    xendev->poll->pending = pending;
+
+    return 0;
+}
+
+EXTERNAL int
+backend_busy_poll_stats(xen_backend_t xenback, int devid,
+                        struct xen_poll_stats *stats)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!xendev->poll)
+        return -1;
+    *stats = xendev->poll->stats;
+    return 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __PROBES_H__
+# define __PROBES_H__
+
+/*
+ * USDT static tracepoints, provider "libxenbackend".
+ *
+ * Built with --enable-probes, each probe is a single nop in the
+ * instruction stream plus an ELF note, which perf, bpftrace and
+ * systemtap can attach to at runtime, e.g.:
+ *
+ *   bpftrace -e 'usdt:/usr/lib/libxenbackend.so:libxenbackend:set_state
+ *                { printf("%d/%d %d -> %d\n", arg0, arg1, arg2, arg3); }'
+ *
+ * Without it, the probes compile to nothing.
+ */
+
+# if defined(ENABLE_PROBES) && defined(HAVE_SYS_SDT_H)
+#  include <sys/sdt.h>
+#  define PROBE1(name, a)                                                      \
+    DTRACE_PROBE1(libxenbackend, name, a)
+#  define PROBE2(name, a, b)                                                   \
+    DTRACE_PROBE2(libxenbackend, name, a, b)
+#  define PROBE3(name, a, b, c)                                                \
+    DTRACE_PROBE3(libxenbackend, name, a, b, c)
+#  define PROBE4(name, a, b, c, d)                                             \
+    DTRACE_PROBE4(libxenbackend, name, a, b, c, d)
+# else
+#  define PROBE1(name, a)               do { } while (0)
+#  define PROBE2(name, a, b)            do { } while (0)
+#  define PROBE3(name, a, b, c)         do { } while (0)
+#  define PROBE4(name, a, b, c, d)      do { } while (0)
+# endif
+
+#endif /* __PROBES_H__ */
@@ -53,6 +53,10 @@
 #  include <stdlib.h>
 # endif
 
+# ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+# endif
+
 # ifdef HAVE_STRINGS_H
 #  include <strings.h>
 # endif
@@ -110,6 +114,8 @@
 
 # include "xenbackend.h"
 
+# include "probes.h"
+
 # include "prototypes.h"
 
 #endif /* __PROJECT_H__ */
@@ -17,16 +17,25 @@
  */
 
 /* xs.c */
-int xs_write_str(const char *base, const char *node, const char *val);
-char *xs_read_str(const char *base, const char *node);
-int xs_write_int(const char *base, const char *node, int ival);
-int xs_read_int(const char *base, const char *node, int *ival);
+int xs_write_str(struct xs_handle *xsh, const char *base, const char *node, const char *val);
+char *xs_read_str_len(struct xs_handle *xsh, const char *base, const char *node, unsigned int *len);
+char *xs_read_str(struct xs_handle *xsh, const char *base, const char *node);
+int xs_read_buf(struct xs_handle *xsh, const char *base, const char *node, char *buf, unsigned int sz);
+int xs_parse_int(const char *val, int *ival);
+int xs_parse_ulong(const char *val, unsigned long *lval);
+int xs_write_int(struct xs_handle *xsh, const char *base, const char *node, int ival);
+int xs_read_int(struct xs_handle *xsh, const char *base, const char *node, int *ival);
+const char *xs_be_path(struct xen_device *xendev, char *buf);
 int xs_write_be_str(struct xen_device *xendev, const char *node, const char *val);
 int xs_write_be_int(struct xen_device *xendev, const char *node, int ival);
 char *xs_read_be_str(struct xen_device *xendev, const char *node);
 int xs_read_be_int(struct xen_device *xendev, const char *node, int *ival);
 char *xs_read_fe_str(struct xen_device *xendev, const char *node);
 int xs_read_fe_int(struct xen_device *xendev, const char *node, int *ival);
+int backend_read(xen_backend_t xenback, int devid, const char *node, char *buf, unsigned int len);
+int frontend_read(xen_backend_t xenback, int devid, const char *node, char *buf, unsigned int len);
+int backend_read_int(xen_backend_t xenback, int devid, const char *node, int *ival);
+int frontend_read_int(xen_backend_t xenback, int devid, const char *node, int *ival);
 int backend_print(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
 int backend_scan(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
 int frontend_scan(xen_backend_t xenback, int devid, const char *node, const char *fmt, ...);
@@ -38,9 +47,19 @@ int check_state_early(struct xen_device *xendev);
 /* backend.c */
 int backend_init(int backend_domid);
 int backend_close(void);
+void reclaim_device(struct xen_device *xendev);
 xen_backend_t backend_register(const char *type, int domid, struct xen_backend_ops *ops, backend_private_t priv);
+xen_backend_t backend_register_async(const char *type, int domid, struct xen_backend_ops *ops, backend_private_t priv, xen_backend_synced_t synced);
 void backend_release(xen_backend_t xenback);
-void backend_xenstore_handler(void *unused);
+void backend_set_thread_safe(xen_backend_t xenback, int safe);
+int backend_release_domain(int domid, unsigned int nthreads, unsigned long long *elapsed_ns);
+struct xen_backend *live_backend(void *p);
+struct xen_device **collect_devices(struct xen_backend *which, int domid);
+int device_live(struct xen_device *xendev);
+int decode_backend_path(struct xen_backend *xenback, char *path, char **node);
+char *decode_frontend_path(struct xen_device *xendev, char *path);
+void *decode_token(const char *token);
+void backend_xenstore_handler(void *priv);
 int backend_xenstore_fd(void);
 int backend_bind_evtchn(xen_backend_t xenback, int devid);
 void backend_unbind_evtchn(xen_backend_t xenback, int devid);
@@ -49,3 +68,95 @@ void *backend_evtchn_priv(xen_backend_t xenback, int devid);
 void backend_evtchn_handler(void *priv);
 void *backend_map_shared_page(xen_backend_t xenback, int devid);
 void backend_unmap_shared_page(xen_backend_t xenback, int devid, void *page);
+/* keys.c */
+struct xen_key *key_lookup_be(struct xen_backend *xenback, const char *node);
+struct xen_key *key_lookup_fe(struct xen_backend *xenback, const char *node);
+int keys_init(struct xen_backend *xenback);
+int keys_add_auto_connect(struct xen_backend *xenback);
+void keys_release(struct xen_backend *xenback);
+int backend_register_keys(xen_backend_t xenback, const struct xen_backend_keys *keys);
+/* schema.c */
+int backend_bind(xen_backend_t xenback, int devid, const struct xen_field *schema, void *obj, unsigned long long *changed);
+int frontend_bind(xen_backend_t xenback, int devid, const struct xen_field *schema, void *obj, unsigned long long *changed);
+/* poll.c */
+unsigned long long now_ns(void);
+void busy_poll(struct xen_device *xendev);
+int backend_set_busy_poll(xen_backend_t xenback, int devid, unsigned int window_us, int (*pending)(xen_device_t xendev));
+int backend_busy_poll_stats(xen_backend_t xenback, int devid, struct xen_poll_stats *stats);
+/* gnttab.c */
+void device_gnttab_close(struct xen_device *xendev);
+int backend_grant_copy(xen_backend_t xenback, int devid, struct xen_grant_copy *segs, unsigned int count);
+/* checkpoint.c */
+struct checkpoint *checkpoint_snapshot(struct xen_device *xendev);
+int backend_checkpoint(const char *path);
+int backend_restore(const char *path);
+struct checkpoint *checkpoint_take(struct xen_device *xendev);
+/* sched.c */
+int sched_enabled(void);
+void sched_init_device(struct xen_device *xendev);
+void sched_enqueue(struct xen_device *xendev);
+void sched_dequeue(struct xen_device *xendev);
+void backend_set_scheduling(int enable);
+int backend_set_priority(xen_backend_t xenback, int devid, int prio, unsigned int weight);
+void backend_requeue_event(xen_backend_t xenback, int devid);
+int backend_pending_events(void);
+int backend_run_events(unsigned int budget);
+int backend_sched_stats(int prio, struct xen_sched_stats *stats);
+/* affinity.c */
+void affinity_init_device(struct xen_device *xendev);
+void backend_set_affinity_policy(enum xen_affinity_policy p);
+int backend_set_affinity(xen_backend_t xenback, int devid, const struct xen_cpuset *set);
+int backend_get_affinity(xen_backend_t xenback, int devid, struct xen_cpuset *set);
+int backend_apply_affinity(xen_backend_t xenback, int devid);
+void *backend_alloc_local(xen_backend_t xenback, int devid, unsigned long size);
+void backend_free_local(void *p, unsigned long size);
+/* wc.c */
+int wc_write(struct xen_device *xendev, const char *node, const char *val);
+const char *wc_pending(struct xen_device *xendev, const char *node);
+int wc_cached(struct xen_device *xendev, const char *node);
+void wc_observe(struct xen_device *xendev, const char *node, const char *val);
+void wc_release(struct xen_device *xendev);
+void wc_flush(struct xen_backend *xenback);
+int backend_set_write_combining(xen_backend_t xenback, int enable);
+void backend_flush(xen_backend_t xenback);
+void backend_write_stats(xen_backend_t xenback, struct xen_write_stats *stats);
+/* timer.c */
+void timer_start(struct xen_timer *t, unsigned int ms, xen_timer_fn_t fn, void *arg);
+void timer_stop(struct xen_timer *t);
+void timer_arm_device(struct xen_device *xendev);
+int backend_set_state_timeout(int state, unsigned int ms);
+xen_timer_t backend_timer_add(unsigned int ms, xen_timer_fn_t fn, void *arg);
+void backend_timer_cancel(xen_timer_t t);
+int backend_timer_fd(void);
+int timer_fd_current(void);
+void timer_fd_close(void);
+int backend_timer_timeout(void);
+void backend_timer_handler(void);
+/* fds.c */
+void fd_notify_device(struct xen_device *xendev, enum xen_fd_op op);
+void fd_notify_xenstore(enum xen_fd_op op);
+void fd_notify_timer(int fd, enum xen_fd_op op);
+int backend_set_fd_notify(xen_fd_notify_t fn, void *opaque);
+/* xlate.c */
+int backend_ring_abi(xen_backend_t xenback, int devid);
+void backend_xlate_set_simd(int enable);
+xen_xlate_t backend_xlate_create(const struct xen_ring_field *fields, unsigned int size32, unsigned int size64, enum xen_ring_abi abi, enum xen_xlate_dir dir);
+void backend_xlate_free(xen_xlate_t x);
+int backend_xlate_simd(xen_xlate_t x);
+void backend_xlate(xen_xlate_t x, void *dst, const void *src, unsigned int n);
+/* connect.c */
+void auto_prefetch(struct xen_device *xendev);
+int auto_connect(struct xen_device *xendev);
+void auto_forget(struct xen_device *xendev);
+void auto_disconnect(struct xen_device *xendev);
+void connect_done(struct xen_device *xendev);
+int backend_set_auto_connect(xen_backend_t xenback, int enable);
+void *backend_ring(xen_backend_t xenback, int devid);
+void backend_connect_stats(xen_backend_t xenback, struct xen_connect_stats *stats);
+/* quiesce.c */
+void backend_set_inflight(xen_backend_t xenback, int (*fn)(xen_device_t dev));
+int backend_quiesce(xen_backend_t xenback, unsigned int timeout_ms, xen_quiesced_t done, void *opaque);
+int backend_quiesce_domain(int domid, unsigned int timeout_ms, xen_quiesced_t done, void *opaque);
+int backend_resume(xen_backend_t xenback);
+int backend_resume_domain(int domid);
+void backend_quiesce_stats(xen_backend_t xenback, struct xen_quiesce_stats *stats);
@@ -0,0 +1,277 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Quiesce and resume, for live migration.
+ *
+ * backend_quiesce() stops event dispatch for the devices of a backend
+ * (backend_quiesce_domain() for those of a domain): their event
+ * channel is left masked when it next fires, they are taken off the
+ * run queues and their fd is reported as needing no events, and a
+ * snapshot of each device's state is kept. It then returns; from
+ * backend_timer_handler(), it checks on the requests the devices have
+ * in flight, as counted by the backend's inflight callback, until they
+ * have completed or a deadline has passed, and reports which through
+ * the done callback.
+ *
+ * backend_resume() turns dispatch back on without going through the
+ * xenbus handshake. A device still in the state of its snapshot gets
+ * its event callback run once, for whatever the frontend queued in the
+ * meantime; one the frontend renegotiated in the meantime is left to
+ * the state machine. On the destination, devices are taken over with
+ * backend_checkpoint()/backend_restore() instead.
+ *
+ * backends_lock is only held to collect the devices concerned: the
+ * application's callbacks (inflight, event, fd notification) are run
+ * after dropping it, so that they may call back into the library, and
+ * each device is checked to still be there first.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+/* How often draining devices are checked on */
+#define QUIESCE_POLL_MS 1
+
+struct quiesce_op
+{
+    struct xen_backend          *which;
+    int                         domid;
+    unsigned long long          start;
+    unsigned long long          deadline;
+    xen_quiesced_t              done;
+    void                        *opaque;
+    struct xen_timer            timer;
+};
+
+static void quiesce_device(struct xen_device *xendev)
+{
+    if (xendev->quiesced)
+        return;
+
+    xendev->quiesced = 1;
+    if (xendev->queued || xendev->requeue)
+        xendev->cold->quiesce_pending = 1;
+    sched_dequeue(xendev);
+    fd_notify_device(xendev, XEN_FD_MOD);
+
+    free(xendev->cold->snapshot);
+    xendev->cold->snapshot = checkpoint_snapshot(xendev);
+}
+
+static void resume_device(struct xen_device *xendev)
+{
+    struct xen_backend *xenback = xendev->backend;
+    struct checkpoint *cp = xendev->cold->snapshot;
+
+    if (!xendev->quiesced)
+        return;
+
+    PROBE3(resume_device, xenback->domid, xendev->devid,
+           xendev->quiesce_masked || xendev->cold->quiesce_pending);
+
+    xendev->quiesced = 0;
+    xendev->cold->quiesce_pending = 0;
+    xendev->cold->snapshot = NULL;
+
+    if (xendev->quiesce_masked && xendev->local_port != -1)
+        xc_evtchn_unmask(xendev->evtchndev, xendev->local_port);
+    xendev->quiesce_masked = 0;
+    fd_notify_device(xendev, XEN_FD_MOD);
+
+    /*
+     * Requests may have been queued without a notification reaching
+     * us, so go through the ring once unless the device has moved on.
+     */
+    if (cp && xendev->be_state == XenbusStateConnected &&
+        cp->be_state == XenbusStateConnected &&
+        xendev->local_port != -1 &&
+        cp->remote_port == xendev->cold->remote_port) {
+        if (sched_enabled())
+            sched_enqueue(xendev);
+        else if (xenback->ops->event)
+            xenback->ops->event(xendev->dev);
+    }
+    free(cp);
+}
+
+/*
+ * Check on the quiesced devices of op, and report once they have all
+ * drained or the deadline has passed.
+ */
+static void quiesce_step(void *arg)
+{
+    struct quiesce_op *op = arg;
+    struct xen_device **devs, **d;
+    unsigned long long now;
+    int busy = 0;
+
+    devs = collect_devices(op->which, op->domid);
+    if (!devs) {
+        timer_start(&op->timer, QUIESCE_POLL_MS, quiesce_step, op);
+        return;
+    }
+
+    for (d = devs; *d; d++)
+        (*d)->backend->quiesce_stats.undrained = 0;
+
+    for (d = devs; *d; d++) {
+        if (!device_live(*d) || !(*d)->quiesced ||
+            !(*d)->backend->inflight)
+            continue;
+        if ((*d)->backend->inflight((*d)->dev) > 0 && device_live(*d)) {
+            (*d)->backend->quiesce_stats.undrained++;
+            busy++;
+        }
+    }
+
+    now = now_ns();
+    if (busy && now < op->deadline) {
+        free(devs);
+        timer_start(&op->timer, QUIESCE_POLL_MS, quiesce_step, op);
+        return;
+    }
+
+    for (d = devs; *d; d++) {
+        if (live_backend(*d))
+            (*d)->backend->quiesce_stats.quiesce_ns = now - op->start;
+    }
+    free(devs);
+
+    PROBE3(quiesce, op->domid, busy, now - op->start);
+    if (op->done)
+        op->done(busy, op->opaque);
+    free(op);
+}
+
+static int quiesce(struct xen_backend *which, int domid,
+                   unsigned int timeout_ms, xen_quiesced_t done,
+                   void *opaque)
+{
+    struct xen_device **devs, **d;
+    struct quiesce_op *op;
+
+    op = calloc(1, sizeof (*op));
+    if (!op)
+        return -1;
+
+    devs = collect_devices(which, domid);
+    if (!devs) {
+        free(op);
+        return -1;
+    }
+
+    op->which = which;
+    op->domid = domid;
+    op->start = now_ns();
+    op->deadline = op->start + timeout_ms * 1000000ULL;
+    op->done = done;
+    op->opaque = opaque;
+
+    for (d = devs; *d; d++)
+        (*d)->backend->quiesce_stats.devices = 0;
+
+    for (d = devs; *d; d++) {
+        if (!device_live(*d))
+            continue;
+        (*d)->backend->quiesce_stats.devices++;
+        quiesce_device(*d);
+    }
+    free(devs);
+
+    timer_start(&op->timer, 0, quiesce_step, op);
+    return 0;
+}
+
+static int resume(struct xen_backend *which, int domid)
+{
+    struct xen_device **devs, **d;
+    unsigned long long start = now_ns();
+    int n = 0;
+
+    devs = collect_devices(which, domid);
+    if (!devs)
+        return -1;
+
+    for (d = devs; *d; d++) {
+        if (!device_live(*d) || !(*d)->quiesced)
+            continue;
+        resume_device(*d);
+        n++;
+    }
+
+    for (d = devs; *d; d++) {
+        if (!live_backend(*d))
+            continue;
+        wc_flush((*d)->backend);
+        (*d)->backend->quiesce_stats.resume_ns = now_ns() - start;
+    }
+    free(devs);
+
+    return n;
+}
+
+/*
+ * fn(dev) returns the number of requests dev has in flight, for
+ * backend_quiesce() to wait on.
+ */
+EXTERNAL void
+backend_set_inflight(xen_backend_t xenback, int (*fn)(xen_device_t dev))
+{
+    xenback->inflight = fn;
+}
+
+/*
+ * Stop event dispatch for the devices of xenback, then wait, for up to
+ * timeout_ms, for their requests in flight to complete: done(busy,
+ * opaque), if not NULL, is called from backend_timer_handler() with
+ * the number of devices still busy once none is, or at the deadline.
+ * Dispatch is stopped when this returns 0; -1 if out of memory.
+ */
+EXTERNAL int
+backend_quiesce(xen_backend_t xenback, unsigned int timeout_ms,
+                xen_quiesced_t done, void *opaque)
+{
+    return quiesce(xenback, xenback->domid, timeout_ms, done, opaque);
+}
+
+EXTERNAL int
+backend_quiesce_domain(int domid, unsigned int timeout_ms,
+                       xen_quiesced_t done, void *opaque)
+{
+    return quiesce(NULL, domid, timeout_ms, done, opaque);
+}
+
+/* Returns the number of devices resumed, -1 if out of memory */
+EXTERNAL int
+backend_resume(xen_backend_t xenback)
+{
+    return resume(xenback, xenback->domid);
+}
+
+EXTERNAL int
+backend_resume_domain(int domid)
+{
+    return resume(NULL, domid);
+}
+
+EXTERNAL void
+backend_quiesce_stats(xen_backend_t xenback, struct xen_quiesce_stats *stats)
+{
+    *stats = xenback->quiesce_stats;
+}
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Priority scheduling of device events.
+ *
+ * With backend_set_scheduling(1), backend_evtchn_handler() only
+ * acknowledges the event and queues the device on the run queue of its
+ * priority class; backend_run_events() then calls the event callbacks.
+ * Classes are served in priority order, except that a device that has
+ * waited for longer than SCHED_AGE_NS goes ahead of the classes above
+ * its own, so a class that always has work cannot starve the ones
+ * below it. Within a class devices are served round robin, a device
+ * that asks to run again through backend_requeue_event() keeping its
+ * turn for up to weight consecutive events (deficit round robin, one
+ * event costing one).
+ *
+ * The run queues are process wide and not locked: the event handlers
+ * and backend_run_events() must all be called from the one thread that
+ * services the library.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+#define SCHED_AGE_NS    (10 * 1000 * 1000ULL)
+
+struct run_queue
+{
+    struct xen_device           *head;
+    struct xen_device           *tail;
+    struct xen_sched_stats      stats;
+};
+
+static int scheduling = 0;
+static struct run_queue run_queues[XEN_PRIO_CLASSES];
+static struct xen_device *running = NULL;
+
+static void rq_push_tail(struct run_queue *rq, struct xen_device *xendev)
+{
+    xendev->sched_next = NULL;
+    if (rq->tail)
+        rq->tail->sched_next = xendev;
+    else
+        rq->head = xendev;
+    rq->tail = xendev;
+}
+
+static void rq_push_head(struct run_queue *rq, struct xen_device *xendev)
+{
+    xendev->sched_next = rq->head;
+    rq->head = xendev;
+    if (!rq->tail)
+        rq->tail = xendev;
+}
+
+static struct xen_device *rq_pop(struct run_queue *rq)
+{
+    struct xen_device *xendev = rq->head;
+
+    if (xendev) {
+        rq->head = xendev->sched_next;
+        if (!rq->head)
+            rq->tail = NULL;
+        xendev->sched_next = NULL;
+    }
+    return xendev;
+}
+
+INTERNAL int
+sched_enabled(void)
+{
+    return scheduling;
+}
+
+INTERNAL void
+sched_init_device(struct xen_device *xendev)
+{
+    int prio;
+
+    xendev->prio = XEN_PRIO_DEFAULT;
+    xendev->cold->weight = 1;
+    xendev->cold->deficit = 0;
+    xendev->queued = 0;
+    xendev->requeue = 0;
+
+    /*
+     * The toolstack may set the class in the backend directory. Without
+     * scheduling it is of no use, so do not spend a round trip on it.
+     */
+    if (scheduling && !xs_read_be_int(xendev, "priority", &prio) &&
+        prio >= 0 && prio < XEN_PRIO_CLASSES)
+        xendev->prio = prio;
+}
+
+INTERNAL void
+sched_enqueue(struct xen_device *xendev)
+{
+    if (xendev->queued)
+        return;
+
+    /* Held back until backend_resume() */
+    if (xendev->quiesced) {
+        xendev->cold->quiesce_pending = 1;
+        return;
+    }
+
+    if (xendev == running) {
+        xendev->requeue = 1;
+        return;
+    }
+
+    xendev->queued = 1;
+    xendev->sched_ts = now_ns();
+    rq_push_tail(&run_queues[xendev->prio], xendev);
+}
+
+/* Forget a device that is going away */
+INTERNAL void
+sched_dequeue(struct xen_device *xendev)
+{
+    struct run_queue *rq = &run_queues[xendev->prio];
+    struct xen_device **pp;
+    struct xen_device *prev = NULL;
+
+    xendev->requeue = 0;
+    if (!xendev->queued)
+        return;
+
+    for (pp = &rq->head; *pp; prev = *pp, pp = &(*pp)->sched_next) {
+        if (*pp == xendev) {
+            *pp = xendev->sched_next;
+            if (rq->tail == xendev)
+                rq->tail = prev;
+            break;
+        }
+    }
+    xendev->sched_next = NULL;
+    xendev->queued = 0;
+}
+
+/*
+ * Call before registering backends: devices set up while scheduling is
+ * off do not pick up the class the toolstack set for them.
+ */
+EXTERNAL void
+backend_set_scheduling(int enable)
+{
+    scheduling = !!enable;
+}
+
+/*
+ * May be called from the alloc callback. weight is the number of
+ * consecutive events a device may have before yielding to the next
+ * device of its class.
+ */
+EXTERNAL int
+backend_set_priority(xen_backend_t xenback, int devid, int prio,
+                     unsigned int weight)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+    int queued = xendev->queued;
+
+    if (prio < 0 || prio >= XEN_PRIO_CLASSES || weight == 0)
+        return -1;
+
+    if (queued)
+        sched_dequeue(xendev);
+    xendev->prio = prio;
+    xendev->cold->weight = weight;
+    if (queued)
+        sched_enqueue(xendev);
+
+    return 0;
+}
+
+/*
+ * Ask for another event callback, for backends that bound the work done
+ * per callback and still have requests on their ring.
+ */
+EXTERNAL void
+backend_requeue_event(xen_backend_t xenback, int devid)
+{
+    if (scheduling)
+        sched_enqueue(&xenback->devices[devid]);
+}
+
+EXTERNAL int
+backend_pending_events(void)
+{
+    int i;
+
+    for (i = 0; i < XEN_PRIO_CLASSES; i++) {
+        if (run_queues[i].head)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * The highest class with a device queued, unless a lower class has had
+ * its first device waiting for too long.
+ */
+static struct run_queue *pick_queue(unsigned long long now)
+{
+    struct run_queue *rq = NULL;
+    int i;
+
+    for (i = 0; i < XEN_PRIO_CLASSES; i++) {
+        struct xen_device *head = run_queues[i].head;
+
+        if (!head)
+            continue;
+        if (!rq) {
+            rq = &run_queues[i];
+        } else if (now - head->sched_ts > SCHED_AGE_NS) {
+            run_queues[i].stats.aged++;
+            return &run_queues[i];
+        }
+    }
+    return rq;
+}
+
+/*
+ * Dispatch up to budget queued events. Returns the number dispatched;
+ * if backend_pending_events() is still true afterwards, the caller
+ * should come back before blocking.
+ */
+EXTERNAL int
+backend_run_events(unsigned int budget)
+{
+    int n = 0;
+
+    while (budget) {
+        struct run_queue *rq;
+        struct xen_device *xendev;
+        struct xen_backend *xenback;
+        unsigned long long now = now_ns();
+        unsigned long long delay;
+
+        rq = pick_queue(now);
+        if (!rq)
+            break;
+
+        xendev = rq_pop(rq);
+        xendev->queued = 0;
+        if (xendev->cold->deficit <= 0)
+            xendev->cold->deficit = xendev->cold->weight;
+        xendev->cold->deficit--;
+
+        delay = now - xendev->sched_ts;
+        rq->stats.dispatched++;
+        rq->stats.delay_ns += delay;
+        if (delay > rq->stats.max_delay_ns)
+            rq->stats.max_delay_ns = delay;
+        PROBE4(sched_dispatch, xendev->backend->domid, xendev->devid,
+               xendev->prio, delay);
+
+        xenback = xendev->backend;
+        running = xendev;
+        if (xenback->ops->event)
+            xenback->ops->event(xendev->dev);
+        running = NULL;
+        wc_flush(xenback);
+
+        if (xendev->requeue) {
+            xendev->requeue = 0;
+            xendev->queued = 1;
+            xendev->sched_ts = now_ns();
+            /* Keep the turn while the device has credit left */
+            if (xendev->cold->deficit > 0)
+                rq_push_head(&run_queues[xendev->prio], xendev);
+            else
+                rq_push_tail(&run_queues[xendev->prio], xendev);
+        }
+
+        budget--;
+        n++;
+    }
+
+    return n;
+}
+
+EXTERNAL int
+backend_sched_stats(int prio, struct xen_sched_stats *stats)
+{
+    if (prio < 0 || prio >= XEN_PRIO_CLASSES)
+        return -1;
+    *stats = run_queues[prio].stats;
+    return 0;
+}
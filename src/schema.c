@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Schema driven binding of xenstore nodes into backend structs, e.g.:
+ *
+ *   struct ring_config {
+ *       unsigned long ring_ref;
+ *       unsigned int evtchn;
+ *       char protocol[32];
+ *   };
+ *
+ *   static const struct xen_field ring_schema[] = {
+ *       { "ring-ref", XEN_FIELD_ULONG,
+ *         offsetof(struct ring_config, ring_ref), 0, NULL, XEN_FIELD_REQUIRED },
+ *       { "event-channel", XEN_FIELD_UINT,
+ *         offsetof(struct ring_config, evtchn), 0, NULL, XEN_FIELD_REQUIRED },
+ *       { "protocol", XEN_FIELD_STRING,
+ *         offsetof(struct ring_config, protocol), 32, "x86_64-abi", 0 },
+ *       { NULL }
+ *   };
+ *
+ *   frontend_bind(xenback, devid, ring_schema, &cfg, &changed);
+ */
+
+#include "project.h"
+#include "backend.h"
+
+static int parse_field(const struct xen_field *field, const char *val,
+                       void *out)
+{
+    unsigned long lval;
+    int ival;
+
+    switch (field->type) {
+    case XEN_FIELD_INT:
+        return xs_parse_int(val, out);
+    case XEN_FIELD_UINT:
+        if (xs_parse_ulong(val, &lval) || lval > UINT_MAX)
+            return -1;
+        *(unsigned int *)out = lval;
+        return 0;
+    case XEN_FIELD_ULONG:
+        return xs_parse_ulong(val, out);
+    case XEN_FIELD_BOOL:
+        if (xs_parse_int(val, &ival))
+            return -1;
+        *(int *)out = !!ival;
+        return 0;
+    case XEN_FIELD_STRING:
+        if (strlen(val) >= field->size)
+            return -1;
+        memset(out, 0, field->size);
+        strcpy(out, val);
+        return 0;
+    }
+    return -1;
+}
+
+static unsigned long field_size(const struct xen_field *field)
+{
+    switch (field->type) {
+    case XEN_FIELD_INT:
+    case XEN_FIELD_BOOL:
+        return sizeof (int);
+    case XEN_FIELD_UINT:
+        return sizeof (unsigned int);
+    case XEN_FIELD_ULONG:
+        return sizeof (unsigned long);
+    case XEN_FIELD_STRING:
+        return field->size;
+    }
+    return 0;
+}
+
+/*
+ * Fill obj from the nodes under base. Bit i of *changed is set when
+ * field i (for the first 64 fields) ended up with a different value
+ * than obj held on entry. Returns -1 if a required node is missing
+ * (and has no default) or does not parse, in which case that field is
+ * left untouched; def never stands in for a required node that is
+ * present but malformed.
+ */
+static int bind(struct xs_handle *xsh, const char *base,
+                const struct xen_field *schema, void *obj,
+                unsigned long long *changed)
+{
+    char val[PATH_BUFSZ];
+    union {
+        unsigned long l;
+        char s[PATH_BUFSZ];
+    } tmp;
+    unsigned long long mask = 0;
+    int i;
+    int rc = 0;
+
+    for (i = 0; schema[i].node; i++) {
+        const struct xen_field *field = &schema[i];
+        void *dst = (char *)obj + field->offset;
+        unsigned long sz = field_size(field);
+        int present, parsed;
+
+        if (sz == 0 || sz > sizeof (tmp)) {
+            rc = -1;
+            continue;
+        }
+
+        present = base && xs_read_buf(xsh, base, field->node, val,
+                                      sizeof (val)) >= 0;
+        parsed = present && !parse_field(field, val, &tmp);
+
+        /* A required node that is there but garbled is not missing */
+        if (!parsed && present && (field->flags & XEN_FIELD_REQUIRED)) {
+            rc = -1;
+            continue;
+        }
+        if (!parsed && field->def)
+            parsed = !parse_field(field, field->def, &tmp);
+
+        if (!parsed) {
+            if (field->flags & XEN_FIELD_REQUIRED)
+                rc = -1;
+            continue;
+        }
+
+        if (memcmp(dst, &tmp, sz)) {
+            memcpy(dst, &tmp, sz);
+            if (i < 64)
+                mask |= 1ULL << i;
+        }
+    }
+
+    if (changed)
+        *changed = mask;
+
+    return rc;
+}
+
+EXTERNAL int
+backend_bind(xen_backend_t xenback, int devid,
+             const struct xen_field *schema, void *obj,
+             unsigned long long *changed)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+    char be[PATH_BUFSZ];
+
+    return bind(xenback->xsh, xs_be_path(xendev, be), schema, obj, changed);
+}
+
+EXTERNAL int
+frontend_bind(xen_backend_t xenback, int devid,
+              const struct xen_field *schema, void *obj,
+              unsigned long long *changed)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    return bind(xenback->xsh, xendev->fe, schema, obj, changed);
+}
@@ -23,51 +23,122 @@ INTERNAL void
 backend_changed(struct xen_device *xendev, const char *node)
 {
     struct xen_backend *xenback = xendev->backend;
+    struct xen_key *key;
+    char *val;
 
-    if (node == NULL || !strcmp(node, "online")) {
+    PROBE3(backend_changed, xenback->domid, xendev->devid, node);
+
+    if (node == NULL) {
         if (xs_read_be_int(xendev, "online", &xendev->online))
             xendev->online = 0;
+        return;
+    }
+
+    /*
+     * Nodes the backend did not register are not read, unless the write
+     * cache holds a value for them that may now be stale.
+     */
+    key = key_lookup_be(xenback, node);
+    if (xenback->keys && !key && !wc_cached(xendev, node))
+        return;
+
+    /* One read serves both our own bookkeeping and the callback. */
+    val = xs_read_be_str(xendev, node);
+    wc_observe(xendev, node, val);
+
+    if (xenback->keys && !key) {
+        free(val);
+        return;
     }
 
-    if (node) {
-        char *val = xs_read_be_str(xendev, node);
+    if (key && (key->flags & KEY_ONLINE)) {
+        if (!val || xs_parse_int(val, &xendev->online))
+            xendev->online = 0;
+    }
 
+    if (!xenback->keys) {
         if (xenback->ops->backend_changed)
             xenback->ops->backend_changed(xendev->dev, node, val);
-        free(val);
+    } else if (key->id != -1) {
+        if (xenback->keys->backend_changed)
+            xenback->keys->backend_changed(xendev->dev, key->id, val);
+        else if (xenback->ops->backend_changed)
+            xenback->ops->backend_changed(xendev->dev, node, val);
     }
+    free(val);
 }
 
 INTERNAL void
 frontend_changed(struct xen_device *xendev, const char *node)
 {
     struct xen_backend *xenback = xendev->backend;
+    struct xen_key *key;
+    char *val;
 
-    if (node == NULL || !strcmp(node, "state")) {
+    PROBE3(frontend_changed, xenback->domid, xendev->devid, node);
+
+    if (node == NULL) {
         if (xs_read_fe_int(xendev, "state", (int *)&xendev->fe_state))
             xendev->fe_state = XenbusStateUnknown;
-    }
 
-    if (node == NULL || !strcmp(node, "protocol")) {
         if (xendev->protocol)
             free(xendev->protocol);
-
         xendev->protocol = xs_read_fe_str(xendev, "protocol");
+        return;
+    }
+
+    key = key_lookup_fe(xenback, node);
+    if (xenback->keys && !key)
+        return;
+
+    val = xs_read_fe_str(xendev, node);
+
+    if (key && (key->flags & KEY_STATE)) {
+        if (!val || xs_parse_int(val, (int *)&xendev->fe_state))
+            xendev->fe_state = XenbusStateUnknown;
+    }
+
+    if (key && (key->flags & KEY_RING)) {
+        if (!val || xs_parse_int(val, &xendev->cold->fe_ring_ref))
+            xendev->cold->fe_ring_ref = -1;
     }
 
-    if (node) {
-        char *val = xs_read_fe_str(xendev, node);
+    if (key && (key->flags & KEY_EVTCHN)) {
+        if (!val || xs_parse_int(val, &xendev->cold->fe_evtchn))
+            xendev->cold->fe_evtchn = -1;
+    }
+
+    if (key && (key->flags & (KEY_RING | KEY_EVTCHN)))
+        auto_prefetch(xendev);
+
+    if (key && (key->flags & KEY_PROTOCOL)) {
+        /* Keep the value we just read rather than duplicating it. */
+        if (xendev->protocol)
+            free(xendev->protocol);
+        xendev->protocol = val;
+    }
 
+    if (!xenback->keys) {
         if (xenback->ops->frontend_changed)
             xenback->ops->frontend_changed(xendev->dev, node, val);
-        free(val);
+    } else if (key->id != -1) {
+        if (xenback->keys->frontend_changed)
+            xenback->keys->frontend_changed(xendev->dev, key->id, val);
+        else if (xenback->ops->frontend_changed)
+            xenback->ops->frontend_changed(xendev->dev, node, val);
     }
+
+    if (val != xendev->protocol)
+        free(val);
 }
 
 static int set_state(struct xen_device *xendev, enum xenbus_state state)
 {
     int rc;
 
+    PROBE4(set_state, xendev->backend->domid, xendev->devid,
+           xendev->be_state, state);
+
     rc = xs_write_be_int(xendev, "state", state);
     if (rc < 0)
 	return rc;
@@ -78,11 +149,14 @@ static int set_state(struct xen_device *xendev, enum xenbus_state state)
 
 static int try_setup(struct xen_device *xendev)
 {
+    struct xen_backend *xenback = xendev->backend;
     int be_state;
     char token[TOKEN_BUFSZ];
     int rc;
 
     rc = xs_read_be_int(xendev, "state", &be_state);
+    PROBE4(try_setup, xendev->backend->domid, xendev->devid,
+           rc ? -1 : be_state, xendev->fe_state);
     if (rc == -1)
         return -1;
 
@@ -92,12 +166,13 @@ static int try_setup(struct xen_device *xendev)
     xendev->fe = xs_read_be_str(xendev, "frontend");
     if (xendev->fe == NULL)
         return -1;
+    xendev->fe_len = strlen(xendev->fe);
 
     rc = snprintf(token, TOKEN_BUFSZ, MAGIC_STRING"%p", xendev);
     if (rc < 0 || rc >= PATH_BUFSZ)
         return -1;
 
-    if (!xs_watch(xs_handle, xendev->fe, token))
+    if (!xs_watch(xenback->xsh, xendev->fe, token))
         return -1;
 
     set_state(xendev, XenbusStateInitialising);
@@ -113,6 +188,8 @@ static int try_init(struct xen_device *xendev)
     struct xen_backend *xenback = xendev->backend;
     int rc = 0;
 
+    PROBE3(try_init, xenback->domid, xendev->devid, xendev->online);
+
     if (!xendev->online)
         return -1;
 
@@ -133,18 +210,26 @@ static int try_connect(struct xen_device *xendev)
     struct xen_backend *xenback = xendev->backend;
     int rc = 0;
 
+    PROBE3(try_connect, xenback->domid, xendev->devid, xendev->fe_state);
+
     if (xendev->fe_state != XenbusStateInitialised &&
         xendev->fe_state != XenbusStateConnected) {
         return -1;
     }
 
+    if (xenback->auto_connect && auto_connect(xendev))
+        return -1;
+
     if (xenback->ops->connect) {
         rc = xenback->ops->connect(xendev->dev);
-        if (rc)
+        if (rc) {
+            auto_disconnect(xendev);
             return rc;
+        }
     }
 
     set_state(xendev, XenbusStateConnected);
+    connect_done(xendev);
     return 0;
 }
 
@@ -153,6 +238,8 @@ static int try_reset(struct xen_device *xendev)
     if (xendev->fe_state != XenbusStateInitialising)
         return -1;
 
+    xendev->cold->handshake_ts = now_ns();
+    auto_forget(xendev);
     set_state(xendev, XenbusStateInitialising);
     return 0;
 }
@@ -166,11 +253,11 @@ static void disconnect(struct xen_device *xendev, enum xenbus_state state)
 
         if (xenback->ops->disconnect)
             xenback->ops->disconnect(xendev->dev);
+        auto_disconnect(xendev);
     }
 
     if (xendev->be_state != state)
         set_state(xendev, state);
-
 }
 
 INTERNAL void
@@ -181,6 +268,7 @@ check_state(struct xen_device *xendev)
     if (xendev->fe_state == XenbusStateClosing ||
 	xendev->fe_state == XenbusStateClosed) {
 	disconnect(xendev, xendev->fe_state);
+	timer_arm_device(xendev);
 	return;
     }
 
@@ -205,11 +293,76 @@ check_state(struct xen_device *xendev)
 	    break;
     }
 
+    timer_arm_device(xendev);
+}
+
+/*
+ * Pick up a device that a previous instance of the daemon checkpointed
+ * while Connected, without taking the frontend through the handshake
+ * again: the backend gets its init and connect callbacks, but the
+ * backend state node is left alone.
+ */
+static int try_adopt(struct xen_device *xendev, struct checkpoint *cp)
+{
+    struct xen_backend *xenback = xendev->backend;
+    char token[TOKEN_BUFSZ];
+    int val;
+
+    xendev->fe = xs_read_be_str(xendev, "frontend");
+    if (xendev->fe == NULL)
+        return -1;
+    xendev->fe_len = strlen(xendev->fe);
+
+    /* The frontend must not have renegotiated while we were away */
+    if (cp->remote_port != -1 &&
+        (xs_read_fe_int(xendev, "event-channel", &val) ||
+         val != cp->remote_port))
+        goto fail;
+    if (cp->ring_mfn != -1 &&
+        (xs_read_fe_int(xendev, "page-ref", &val) || val != cp->ring_mfn))
+        goto fail;
+
+    snprintf(token, TOKEN_BUFSZ, MAGIC_STRING"%p", xendev);
+    if (!xs_watch(xenback->xsh, xendev->fe, token))
+        goto fail;
+
+    backend_changed(xendev, NULL);
+    frontend_changed(xendev, NULL);
+
+    if (!xendev->online || xendev->fe_state != XenbusStateConnected)
+        goto fail_watch;
+
+    if (xenback->ops->init && xenback->ops->init(xendev->dev))
+        goto fail_watch;
+
+    if (xenback->ops->connect && xenback->ops->connect(xendev->dev))
+        goto fail_connect;
+
+    xendev->be_state = XenbusStateConnected;
+    PROBE3(adopt, xenback->domid, xendev->devid, xendev->local_port);
+
+    /* Requests may have been queued while nobody was listening */
+    if (xendev->local_port != -1)
+        xc_evtchn_notify(xendev->evtchndev, xendev->local_port);
+
+    return 0;
+
+fail_connect:
+    if (xenback->ops->disconnect)
+        xenback->ops->disconnect(xendev->dev);
+fail_watch:
+    xs_unwatch(xenback->xsh, xendev->fe, token);
+fail:
+    free(xendev->fe);
+    xendev->fe = NULL;
+    return -1;
 }
 
 INTERNAL int
 check_state_early(struct xen_device *xendev)
 {
+    struct checkpoint *cp;
+    int adopted;
     int rc;
     int be_state;
 
@@ -218,6 +371,14 @@ check_state_early(struct xen_device *xendev)
         return -1;
 
     if (be_state == XenbusStateConnected) {
+        cp = checkpoint_take(xendev);
+        if (cp) {
+            adopted = !try_adopt(xendev, cp);
+            free(cp);
+            if (adopted)
+                return 0;
+        }
+
         set_state(xendev, XenbusStateInitialising);
         xendev->be_state = XenbusStateUnknown;
     }
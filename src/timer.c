@@ -0,0 +1,404 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Timers.
+ *
+ * A hierarchical timer wheel with a resolution of one millisecond:
+ * WHEEL_LEVELS levels of WHEEL_SIZE slots, each slot of a level
+ * covering WHEEL_SIZE slots of the level below. A timer goes in the
+ * slot of the lowest level whose span holds its expiry, and moves down
+ * a level each time the level below wraps around, so starting and
+ * stopping a timer is a list insert or remove.
+ *
+ * The wheel runs from backend_timer_handler(), which the application
+ * calls when backend_timer_fd() becomes readable or, without timerfd,
+ * after waiting for at most backend_timer_timeout() milliseconds.
+ *
+ * The library uses a timer per device to enforce the timeouts set with
+ * backend_set_state_timeout(): a device that stays in a backend state
+ * for longer than that is closed and released (see reclaim_device()).
+ *
+ * The wheel is process wide and not locked. It belongs to the thread
+ * that services the library: timers are started and stopped from the
+ * handlers that thread runs, and from backend_register*(),
+ * backend_release*(), backend_timer_add() and backend_timer_cancel(),
+ * which the application must call from that thread too. The teardown
+ * threads of backend_release_domain() leave timers alone (see
+ * detach_device()).
+ */
+
+#include <time.h>
+
+#include "project.h"
+#include "backend.h"
+
+#ifdef HAVE_SYS_TIMERFD_H
+# include <sys/timerfd.h>
+#endif
+
+#define TIMER_TICK_NS   1000000ULL
+
+#define WHEEL_BITS      6
+#define WHEEL_SIZE      (1 << WHEEL_BITS)
+#define WHEEL_MASK      (WHEEL_SIZE - 1)
+#define WHEEL_LEVELS    4
+#define WHEEL_SPAN      (1ULL << (WHEEL_BITS * WHEEL_LEVELS))
+
+#define XENBUS_STATES   (XenbusStateReconfigured + 1)
+
+static struct xen_timer_list wheel[WHEEL_LEVELS][WHEEL_SIZE];
+static unsigned int wheel_count[WHEEL_LEVELS];
+static unsigned int wheel_timers = 0;
+static unsigned long long wheel_now = 0;        /* last tick run */
+static int wheel_running = 0;
+
+static int timer_fd = -1;
+static unsigned long long timer_fd_tick = 0;    /* 0 if disarmed */
+
+static unsigned int state_timeouts[XENBUS_STATES];
+
+static unsigned long long now_tick(void)
+{
+    return now_ns() / TIMER_TICK_NS;
+}
+
+static void timer_fd_arm(unsigned long long tick)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    struct itimerspec its;
+
+    if (timer_fd == -1 || tick == timer_fd_tick)
+        return;
+
+    memset(&its, 0, sizeof (its));
+    if (tick) {
+        its.it_value.tv_sec = tick * TIMER_TICK_NS / 1000000000ULL;
+        its.it_value.tv_nsec = tick * TIMER_TICK_NS % 1000000000ULL;
+    }
+    if (!timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL))
+        timer_fd_tick = tick;
+#endif
+}
+
+/*
+ * min is the first tick the timer may go in: the next one, or the
+ * current one while the wheel is cascading before running it.
+ */
+static void wheel_insert(struct xen_timer *t, unsigned long long min)
+{
+    unsigned long long expires;
+    unsigned long long delta;
+    int level;
+
+    if (t->expires < min)
+        t->expires = min;
+
+    expires = t->expires;
+    delta = expires - wheel_now;
+    if (delta >= WHEEL_SPAN) {
+        /* Parked in the last slot, it is placed again when cascaded */
+        expires = wheel_now + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+
+    for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+        if (delta < 1ULL << ((level + 1) * WHEEL_BITS))
+            break;
+    }
+
+    LIST_INSERT_HEAD(&wheel[level][(expires >> (level * WHEEL_BITS)) &
+                                   WHEEL_MASK], t, link);
+    t->level = level;
+    wheel_count[level]++;
+    wheel_timers++;
+}
+
+static void wheel_remove(struct xen_timer *t)
+{
+    LIST_REMOVE(t, link);
+    wheel_count[t->level]--;
+    wheel_timers--;
+}
+
+static void wheel_cascade(int level)
+{
+    struct xen_timer_list *slot;
+    struct xen_timer *t;
+
+    slot = &wheel[level][(wheel_now >> (level * WHEEL_BITS)) & WHEEL_MASK];
+    while (!LIST_EMPTY(slot)) {
+        t = LIST_FIRST(slot);
+        wheel_remove(t);
+        wheel_insert(t, wheel_now);
+    }
+}
+
+static void wheel_run(unsigned long long target)
+{
+    struct xen_timer_list *slot;
+    struct xen_timer *t;
+    xen_timer_fn_t fn;
+    void *arg;
+    int level;
+
+    while (wheel_now < target) {
+        if (!wheel_timers) {
+            wheel_now = target;
+            break;
+        }
+
+        /* Nothing can expire before the first non-empty level cascades */
+        for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+            if (wheel_count[level])
+                break;
+        }
+        if (level) {
+            unsigned long long next;
+
+            next = ((wheel_now >> (level * WHEEL_BITS)) + 1) <<
+                   (level * WHEEL_BITS);
+            wheel_now = next - 1 < target ? next - 1 : target;
+            if (wheel_now == target)
+                break;
+        }
+
+        wheel_now++;
+        for (level = 1; level < WHEEL_LEVELS; level++) {
+            if ((wheel_now >> ((level - 1) * WHEEL_BITS)) & WHEEL_MASK)
+                break;
+            wheel_cascade(level);
+        }
+
+        slot = &wheel[0][wheel_now & WHEEL_MASK];
+        while (!LIST_EMPTY(slot)) {
+            t = LIST_FIRST(slot);
+            wheel_remove(t);
+            t->armed = 0;
+
+            fn = t->fn;
+            arg = t->arg;
+            if (t->alloced)
+                free(t);
+            fn(arg);
+        }
+    }
+}
+
+/* Tick at which the wheel next has something to do, 0 if never */
+static unsigned long long wheel_next(void)
+{
+    unsigned long long next = 0;
+    unsigned long long base;
+    int level, k;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (!wheel_count[level])
+            continue;
+
+        base = wheel_now >> (level * WHEEL_BITS);
+        for (k = 1; k <= WHEEL_SIZE; k++) {
+            if (!LIST_EMPTY(&wheel[level][(base + k) & WHEEL_MASK])) {
+                unsigned long long tick = (base + k) << (level * WHEEL_BITS);
+
+                if (!next || tick < next)
+                    next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+INTERNAL void
+timer_start(struct xen_timer *t, unsigned int ms, xen_timer_fn_t fn,
+            void *arg)
+{
+    unsigned long long now = now_tick();
+
+    if (t->armed)
+        wheel_remove(t);
+    /* An empty wheel skips ahead, unless it is running */
+    if (!wheel_timers && !wheel_running)
+        wheel_now = now;
+
+    t->fn = fn;
+    t->arg = arg;
+    t->expires = now + ms;
+    t->armed = 1;
+    wheel_insert(t, wheel_now + 1);
+
+    if (!timer_fd_tick || t->expires < timer_fd_tick)
+        timer_fd_arm(t->expires);
+}
+
+INTERNAL void
+timer_stop(struct xen_timer *t)
+{
+    if (!t->armed)
+        return;
+    wheel_remove(t);
+    t->armed = 0;
+}
+
+static void device_expired(void *arg)
+{
+    struct xen_device *xendev = arg;
+
+    reclaim_device(xendev);
+}
+
+/* Called whenever the state machine has run for the device */
+INTERNAL void
+timer_arm_device(struct xen_device *xendev)
+{
+    unsigned int ms = 0;
+
+    if (xendev->cold->timer.armed && xendev->cold->timer_state == xendev->be_state)
+        return;
+
+    if (xendev->be_state < XENBUS_STATES)
+        ms = state_timeouts[xendev->be_state];
+
+    xendev->cold->timer_state = xendev->be_state;
+    if (ms)
+        timer_start(&xendev->cold->timer, ms, device_expired, xendev);
+    else
+        timer_stop(&xendev->cold->timer);
+}
+
+/*
+ * Reclaim devices that stay in backend state state for longer than ms
+ * milliseconds, 0 to never (the default). A frontend that never gets
+ * past Initialising leaves its backend in InitWait, for instance.
+ */
+EXTERNAL int
+backend_set_state_timeout(int state, unsigned int ms)
+{
+    if (state < 0 || state >= XENBUS_STATES) {
+        errno = EINVAL;
+        return -1;
+    }
+    state_timeouts[state] = ms;
+    return 0;
+}
+
+/*
+ * Call fn(arg) once in ms milliseconds, from backend_timer_handler().
+ * The timer is freed once it has fired; it must not be cancelled after
+ * that. Call from the thread that runs backend_timer_handler().
+ */
+EXTERNAL xen_timer_t
+backend_timer_add(unsigned int ms, xen_timer_fn_t fn, void *arg)
+{
+    struct xen_timer *t;
+
+    t = calloc(1, sizeof (*t));
+    if (!t)
+        return NULL;
+
+    t->alloced = 1;
+    timer_start(t, ms, fn, arg);
+
+    return t;
+}
+
+EXTERNAL void
+backend_timer_cancel(xen_timer_t t)
+{
+    timer_stop(t);
+    free(t);
+}
+
+/*
+ * A timerfd that becomes readable when backend_timer_handler() has
+ * work to do, or -1 if the system has none.
+ */
+EXTERNAL int
+backend_timer_fd(void)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    if (timer_fd == -1) {
+        timer_fd = timerfd_create(CLOCK_MONOTONIC,
+                                  TFD_NONBLOCK | TFD_CLOEXEC);
+        timer_fd_tick = 0;
+        timer_fd_arm(wheel_next());
+        fd_notify_timer(timer_fd, XEN_FD_ADD);
+    }
+    return timer_fd;
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+INTERNAL int
+timer_fd_current(void)
+{
+    return timer_fd;
+}
+
+/* From backend_close() */
+INTERNAL void
+timer_fd_close(void)
+{
+    if (timer_fd == -1)
+        return;
+
+    fd_notify_timer(timer_fd, XEN_FD_DEL);
+    close(timer_fd);
+    timer_fd = -1;
+    timer_fd_tick = 0;
+}
+
+/* Milliseconds until backend_timer_handler() has work to do, or -1 */
+EXTERNAL int
+backend_timer_timeout(void)
+{
+    unsigned long long next = wheel_next();
+    unsigned long long now;
+
+    if (!next)
+        return -1;
+
+    now = now_tick();
+    if (next <= now)
+        return 0;
+    if (next - now > INT_MAX)
+        return INT_MAX;
+    return next - now;
+}
+
+EXTERNAL void
+backend_timer_handler(void)
+{
+#ifdef HAVE_SYS_TIMERFD_H
+    uint64_t expirations;
+
+    if (timer_fd != -1 &&
+        read(timer_fd, &expirations, sizeof (expirations)) < 0 &&
+        errno != EAGAIN)
+        return;
+    timer_fd_tick = 0;
+#endif
+
+    wheel_running = 1;
+    wheel_run(now_tick());
+    wheel_running = 0;
+    timer_fd_arm(wheel_next());
+}
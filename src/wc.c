@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Write combining for backend nodes.
+ *
+ * With backend_set_write_combining(), writes to a device's backend
+ * nodes (backend_print(), state changes, ...) are kept per device and
+ * published together in one transaction when the library returns to
+ * the application: at the end of backend_xenstore_handler(),
+ * backend_evtchn_handler(), backend_run_events() and
+ * backend_register(), or on backend_flush(). A write of the value
+ * last seen in xenstore is dropped. Reads of a node with a write
+ * pending return the pending value.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+/* Transactions retried on EAGAIN before writing without one */
+#define WC_RETRIES 4
+
+static struct xen_wc_entry *wc_find(struct xen_device *xendev,
+                                    const char *node)
+{
+    struct xen_wc_entry *e;
+
+    LIST_FOREACH(e, &xendev->cold->wc, link) {
+        if (!strcmp(e->node, node))
+            return e;
+    }
+    return NULL;
+}
+
+/*
+ * Returns 0 if the write was taken care of (queued or dropped), -1 if
+ * the caller has to write it.
+ */
+INTERNAL int
+wc_write(struct xen_device *xendev, const char *node, const char *val)
+{
+    struct xen_backend *xenback = xendev->backend;
+    struct xen_wc_entry *e;
+    char *v;
+
+    /* Devices being torn down write straight through, see detach_device() */
+    if (!xenback->wc || xendev->detached)
+        return -1;
+
+    xenback->wc_stats.requested++;
+
+    e = wc_find(xendev, node);
+    if (e && !strcmp(e->val, val)) {
+        xenback->wc_stats.elided++;
+        return 0;
+    }
+
+    v = strdup(val);
+    if (!v)
+        return -1;
+
+    if (!e) {
+        e = calloc(1, sizeof (*e));
+        if (!e || !(e->node = strdup(node))) {
+            free(e);
+            free(v);
+            return -1;
+        }
+        LIST_INSERT_HEAD(&xendev->cold->wc, e, link);
+    }
+
+    free(e->val);
+    e->val = v;
+    e->dirty = 1;
+    xenback->wc_dirty = 1;
+
+    return 0;
+}
+
+/* The value of a write still pending for node, if any */
+INTERNAL const char *
+wc_pending(struct xen_device *xendev, const char *node)
+{
+    struct xen_wc_entry *e;
+
+    if (!xendev->backend->wc)
+        return NULL;
+
+    e = wc_find(xendev, node);
+    return e && e->dirty ? e->val : NULL;
+}
+
+/* Whether wc_observe() has a value for node to keep up to date */
+INTERNAL int
+wc_cached(struct xen_device *xendev, const char *node)
+{
+    struct xen_wc_entry *e;
+
+    if (!xendev->backend->wc)
+        return 0;
+
+    e = wc_find(xendev, node);
+    return e && !e->dirty;
+}
+
+/* Someone changed node in xenstore, remember what it holds now */
+INTERNAL void
+wc_observe(struct xen_device *xendev, const char *node, const char *val)
+{
+    struct xen_wc_entry *e;
+    char *v;
+
+    if (!xendev->backend->wc)
+        return;
+
+    e = wc_find(xendev, node);
+    if (!e || e->dirty)
+        return;
+
+    if (!val) {
+        LIST_REMOVE(e, link);
+        free(e->node);
+        free(e->val);
+        free(e);
+        return;
+    }
+
+    if (strcmp(e->val, val) && (v = strdup(val))) {
+        free(e->val);
+        e->val = v;
+    }
+}
+
+INTERNAL void
+wc_release(struct xen_device *xendev)
+{
+    struct xen_wc_entry *e, *next;
+
+    LIST_FOREACH_SAFE(e, next, &xendev->cold->wc, link) {
+        LIST_REMOVE(e, link);
+        free(e->node);
+        free(e->val);
+        free(e);
+    }
+}
+
+/*
+ * Write the dirty entries in transaction t. Outside a transaction, each
+ * entry written is marked clean and counted straight away and a failed
+ * one is left dirty for the next flush; returns the number of writes
+ * that failed. In one, stops at the first failure and returns -1; the
+ * entries are only marked and counted once the transaction commits.
+ */
+static int wc_write_all(struct xen_backend *xenback, xs_transaction_t t)
+{
+    char path[PATH_BUFSZ];
+    struct xen_wc_entry *e;
+    int failed = 0;
+    int i;
+
+    for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+        struct xen_device *xendev = &xenback->devices[i];
+
+        LIST_FOREACH(e, &xendev->cold->wc, link) {
+            if (!e->dirty)
+                continue;
+
+            snprintf(path, sizeof (path), "%s/%d/%s", xenback->path,
+                     xendev->devid, e->node);
+            if (!xs_write(xenback->xsh, t, path, e->val, strlen(e->val))) {
+                if (t != XBT_NULL)
+                    return -1;
+                failed++;
+                continue;
+            }
+            if (t == XBT_NULL) {
+                xenback->wc_stats.written++;
+                e->dirty = 0;
+            }
+        }
+    }
+    return failed;
+}
+
+INTERNAL void
+wc_flush(struct xen_backend *xenback)
+{
+    struct xen_wc_entry *e;
+    xs_transaction_t t;
+    int failed;
+    int tries;
+    int i;
+
+    if (!xenback->wc_dirty)
+        return;
+    xenback->wc_dirty = 0;
+
+    for (tries = 0; tries < WC_RETRIES; tries++) {
+        t = xs_transaction_start(xenback->xsh);
+        if (t == XBT_NULL)
+            break;
+
+        if (wc_write_all(xenback, t)) {
+            xs_transaction_end(xenback->xsh, t, true);
+            break;
+        }
+
+        if (xs_transaction_end(xenback->xsh, t, false)) {
+            xenback->wc_stats.flushes++;
+            goto done;
+        }
+        if (errno != EAGAIN)
+            break;
+        xenback->wc_stats.retries++;
+    }
+
+    /*
+     * No transaction to be had: publish the writes one by one. Those
+     * that fail stay pending, so they are neither taken for what
+     * xenstore holds nor lost, and are tried again on the next flush.
+     */
+    failed = wc_write_all(xenback, XBT_NULL);
+    if (failed) {
+        xenback->wc_stats.errors += failed;
+        xenback->wc_dirty = 1;
+    }
+    goto out;
+
+done:
+    for (i = 0; i < BACKEND_DEVICE_MAX; i++) {
+        LIST_FOREACH(e, &xenback->cold[i].wc, link) {
+            if (!e->dirty)
+                continue;
+            e->dirty = 0;
+            xenback->wc_stats.written++;
+        }
+    }
+out:
+    PROBE2(wc_flush, xenback->domid, xenback->wc_stats.written);
+}
+
+/*
+ * Turning combining off publishes the pending writes first. If some of
+ * them cannot be written, it stays on, so that they are not lost, and
+ * -1 is returned.
+ */
+EXTERNAL int
+backend_set_write_combining(xen_backend_t xenback, int enable)
+{
+    int i;
+
+    if (!enable) {
+        wc_flush(xenback);
+        if (xenback->wc_dirty)
+            return -1;
+        for (i = 0; i < BACKEND_DEVICE_MAX; i++)
+            wc_release(&xenback->devices[i]);
+    }
+    xenback->wc = !!enable;
+    return 0;
+}
+
+/* Publish the pending writes now, e.g. after writing from a timer */
+EXTERNAL void
+backend_flush(xen_backend_t xenback)
+{
+    wc_flush(xenback);
+}
+
+EXTERNAL void
+backend_write_stats(xen_backend_t xenback, struct xen_write_stats *stats)
+{
+    *stats = xenback->wc_stats;
+}
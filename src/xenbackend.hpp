@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * C++ (C++11) layer over xenbackend.h, header only.
+ *
+ * The device class is a template parameter: the callbacks the library
+ * calls are one trampoline per operation and device class, which calls
+ * the device's (non virtual) member directly, so the compiler can
+ * inline it. Devices are created with new when the library allocates
+ * them and deleted when it frees them; members left out fall back to
+ * the no-op defaults of xenbackend::device.
+ *
+ *   class vif : public xenbackend::device<vif>
+ *   {
+ *   public:
+ *       vif(xenbackend::backend<vif> &b, int devid)
+ *           : xenbackend::device<vif>(b, devid) {}
+ *       int connect()
+ *       {
+ *           ring_ = map_ring<netif_tx_sring>();
+ *           return ring_ && bind_evtchn() != -1 ? 0 : -1;
+ *       }
+ *       void disconnect() { unbind_evtchn(); ring_.reset(); }
+ *       void event() { ... ring_->req_prod ... }
+ *   private:
+ *       xenbackend::shared_page<netif_tx_sring> ring_;
+ *   };
+ *
+ *   xenbackend::backend<vif> vifs("vif", domid);
+ *   vifs.start();
+ */
+
+#ifndef __XENBACKEND_HPP__
+# define __XENBACKEND_HPP__
+
+# include <new>
+# include <stdexcept>
+# include <string>
+
+# include <xenbackend.h>
+
+namespace xenbackend
+{
+    template <class Device> class backend;
+
+    /* A page shared with the frontend, seen as a T, unmapped on release */
+    template <class T>
+    class shared_page
+    {
+    public:
+        shared_page() : xenback_(0), devid_(-1), page_(0) {}
+        shared_page(xen_backend_t xenback, int devid)
+            : xenback_(xenback), devid_(devid),
+              page_(static_cast<T *>(backend_map_shared_page(xenback, devid)))
+        {}
+        ~shared_page() { reset(); }
+
+        shared_page(const shared_page &) = delete;
+        shared_page &operator=(const shared_page &) = delete;
+
+        shared_page(shared_page &&o) noexcept
+            : xenback_(o.xenback_), devid_(o.devid_), page_(o.page_)
+        {
+            o.page_ = 0;
+        }
+        shared_page &operator=(shared_page &&o) noexcept
+        {
+            if (this != &o) {
+                reset();
+                xenback_ = o.xenback_;
+                devid_ = o.devid_;
+                page_ = o.page_;
+                o.page_ = 0;
+            }
+            return *this;
+        }
+
+        void reset()
+        {
+            if (page_)
+                backend_unmap_shared_page(xenback_, devid_, page_);
+            page_ = 0;
+        }
+
+        T *get() const { return page_; }
+        T *operator->() const { return page_; }
+        T &operator*() const { return *page_; }
+        explicit operator bool() const { return page_ != 0; }
+
+    private:
+        xen_backend_t   xenback_;
+        int             devid_;
+        T               *page_;
+    };
+
+    /*
+     * Base of device classes (CRTP): the default callbacks and the
+     * per-device calls of the C API.
+     */
+    template <class Device>
+    class device
+    {
+    public:
+        device(backend<Device> &b, int devid)
+            : backend_(b), devid_(devid) {}
+
+        device(const device &) = delete;
+        device &operator=(const device &) = delete;
+
+        int init() { return 0; }
+        int connect() { return 0; }
+        void disconnect() {}
+        void backend_changed(const char *, const char *) {}
+        void frontend_changed(const char *, const char *) {}
+        void event() {}
+
+        backend<Device> &owner() const { return backend_; }
+        xen_backend_t handle() const { return backend_.handle(); }
+        int devid() const { return devid_; }
+
+        int bind_evtchn() { return backend_bind_evtchn(handle(), devid_); }
+        void unbind_evtchn() { backend_unbind_evtchn(handle(), devid_); }
+        int notify() { return backend_evtchn_notify(handle(), devid_); }
+
+        template <class T>
+        shared_page<T> map_ring() { return shared_page<T>(handle(), devid_); }
+
+        int read(const char *node, char *buf, unsigned int len)
+        {
+            return backend_read(handle(), devid_, node, buf, len);
+        }
+        int read_int(const char *node, int *val)
+        {
+            return backend_read_int(handle(), devid_, node, val);
+        }
+        int frontend_read(const char *node, char *buf, unsigned int len)
+        {
+            return ::frontend_read(handle(), devid_, node, buf, len);
+        }
+        int frontend_read_int(const char *node, int *val)
+        {
+            return ::frontend_read_int(handle(), devid_, node, val);
+        }
+        template <class... Args>
+        int print(const char *node, const char *fmt, Args... args)
+        {
+            return backend_print(handle(), devid_, node, fmt, args...);
+        }
+
+    private:
+        backend<Device> &backend_;
+        int             devid_;
+    };
+
+    /*
+     * A backend type for one frontend domain. Construction only records
+     * the type: start() registers it, and creates the devices already in
+     * xenstore, so call it once the object (and any class derived from
+     * it, whose state devices reach through owner()) is constructed.
+     * stop() releases it and frees all its devices; the destructor does
+     * so too, but only after derived classes are destroyed, so they
+     * should call stop() from their own destructor.
+     */
+    template <class Device>
+    class backend
+    {
+    public:
+        backend(const char *type, int domid)
+            : type_(type), domid_(domid), xenback_(0) {}
+        virtual ~backend()
+        {
+            stop();
+        }
+
+        void start()
+        {
+            if (xenback_)
+                return;
+            xenback_ = backend_register(type_.c_str(), domid_, &ops_, this);
+            if (!xenback_)
+                throw std::runtime_error("backend_register");
+        }
+        void stop()
+        {
+            if (xenback_)
+                backend_release(xenback_);
+            xenback_ = 0;
+        }
+
+        backend(const backend &) = delete;
+        backend &operator=(const backend &) = delete;
+
+        xen_backend_t handle() const { return xenback_; }
+
+    private:
+        static Device *dev(xen_device_t d) { return static_cast<Device *>(d); }
+
+        static xen_device_t alloc(xen_backend_t xenback, int devid,
+                                  backend_private_t priv)
+        {
+            backend *b = static_cast<backend *>(priv);
+
+            /* Devices found by start() are allocated before it returns */
+            b->xenback_ = xenback;
+            try {
+                return new Device(*b, devid);
+            } catch (...) {
+                return 0;
+            }
+        }
+        static int init(xen_device_t d)
+        {
+            try {
+                return dev(d)->init();
+            } catch (...) {
+                return -1;
+            }
+        }
+        static int connect(xen_device_t d)
+        {
+            try {
+                return dev(d)->connect();
+            } catch (...) {
+                return -1;
+            }
+        }
+        static void disconnect(xen_device_t d)
+        {
+            try {
+                dev(d)->disconnect();
+            } catch (...) {
+            }
+        }
+        static void backend_changed(xen_device_t d, const char *node,
+                                    const char *val)
+        {
+            try {
+                dev(d)->backend_changed(node, val);
+            } catch (...) {
+            }
+        }
+        static void frontend_changed(xen_device_t d, const char *node,
+                                     const char *val)
+        {
+            try {
+                dev(d)->frontend_changed(node, val);
+            } catch (...) {
+            }
+        }
+        static void event(xen_device_t d)
+        {
+            try {
+                dev(d)->event();
+            } catch (...) {
+            }
+        }
+        static void free(xen_device_t d)
+        {
+            delete dev(d);
+        }
+
+        static struct xen_backend_ops ops_;
+
+        std::string     type_;
+        int             domid_;
+        xen_backend_t   xenback_;
+    };
+
+    template <class Device>
+    struct xen_backend_ops backend<Device>::ops_ = {
+        backend<Device>::alloc,
+        backend<Device>::init,
+        backend<Device>::connect,
+        backend<Device>::disconnect,
+        backend<Device>::backend_changed,
+        backend<Device>::frontend_changed,
+        backend<Device>::event,
+        backend<Device>::free,
+    };
+}
+
+#endif /* __XENBACKEND_HPP__ */
@@ -0,0 +1,394 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Translation of ring requests and responses between the frontend's
+ * ABI and the native layout.
+ *
+ * A backend describes its request (or response) once, as the offset of
+ * each field in either ABI; backend_xlate_create() turns that into a
+ * byte map of the native layout. Translating a batch then copies runs
+ * of bytes, or, on CPUs with SSSE3, builds each 16 bytes of the output
+ * with one shuffle of 16 bytes of the input, as long as every 16 bytes
+ * of output come from within 16 bytes of input, which holds for the
+ * usual 32/64 bit differences of padding before 64 bit fields.
+ */
+
+#include "project.h"
+#include "backend.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+# define XLATE_SSSE3
+# include <tmmintrin.h>
+#endif
+
+#define XLATE_SIZE_MAX  4096
+#define XLATE_CHUNK     16
+#define XLATE_ZERO      0xffff  /* run source: fill with zeroes */
+
+/* The ABI we are built for; other than on x86, rings have one layout */
+#if defined(__x86_64__)
+# define ABI_HOST       XEN_ABI_X86_64
+#elif defined(__i386__)
+# define ABI_HOST       XEN_ABI_X86_32
+#else
+# define ABI_HOST       XEN_ABI_NATIVE
+#endif
+
+struct xlate_run
+{
+    unsigned short              dst;
+    unsigned short              src;
+    unsigned short              len;
+};
+
+struct xen_xlate
+{
+    unsigned int                src_size;
+    unsigned int                dst_size;
+    void                        (*fn)(const struct xen_xlate *x, void *dst,
+                                      const void *src, unsigned int n);
+
+    /* Runs covering the output the shuffles do not */
+    unsigned int                nruns;
+    struct xlate_run            *runs;
+
+    /* Shuffles for the first nchunks * XLATE_CHUNK bytes of output */
+    unsigned int                nchunks;
+    unsigned short              *chunk_src;
+    unsigned char               (*shuf)[XLATE_CHUNK];
+};
+
+static int xlate_simd = 1;
+
+static void xlate_copy(const struct xen_xlate *x, void *dst, const void *src,
+                       unsigned int n)
+{
+    memcpy(dst, src, (size_t)n * x->src_size);
+}
+
+static inline void xlate_runs(const struct xen_xlate *x, unsigned char *d,
+                              const unsigned char *s)
+{
+    const struct xlate_run *r;
+    unsigned int i;
+
+    for (i = 0; i < x->nruns; i++) {
+        r = &x->runs[i];
+        if (r->src == XLATE_ZERO)
+            memset(d + r->dst, 0, r->len);
+        else
+            memcpy(d + r->dst, s + r->src, r->len);
+    }
+}
+
+static void xlate_scalar(const struct xen_xlate *x, void *dst,
+                         const void *src, unsigned int n)
+{
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    unsigned int i;
+
+    for (i = 0; i < n; i++) {
+        xlate_runs(x, d, s);
+        d += x->dst_size;
+        s += x->src_size;
+    }
+}
+
+#ifdef XLATE_SSSE3
+__attribute__ ((target ("ssse3")))
+static void xlate_ssse3(const struct xen_xlate *x, void *dst,
+                        const void *src, unsigned int n)
+{
+    unsigned char *d = dst;
+    const unsigned char *s = src;
+    unsigned int i, c;
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < x->nchunks; c++) {
+            __m128i v, m;
+
+            v = _mm_loadu_si128((const __m128i *)(s + x->chunk_src[c]));
+            m = _mm_loadu_si128((const __m128i *)x->shuf[c]);
+            _mm_storeu_si128((__m128i *)(d + c * XLATE_CHUNK),
+                             _mm_shuffle_epi8(v, m));
+        }
+        xlate_runs(x, d, s);
+        d += x->dst_size;
+        s += x->src_size;
+    }
+}
+
+static int have_ssse3(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+#endif
+
+/* Runs reproducing map[from..to), map[i] being the source of byte i */
+static int build_runs(struct xen_xlate *x, const int *map, unsigned int from,
+                      unsigned int to)
+{
+    unsigned int i, n = 0;
+
+    x->runs = malloc((to - from) * sizeof (*x->runs) + 1);
+    if (!x->runs)
+        return -1;
+
+    for (i = from; i < to; i++) {
+        struct xlate_run *r = n ? &x->runs[n - 1] : NULL;
+        unsigned short src = map[i] < 0 ? XLATE_ZERO : map[i];
+
+        if (r && (src == XLATE_ZERO ? r->src == XLATE_ZERO :
+                  r->src != XLATE_ZERO && r->src + r->len == src)) {
+            r->len++;
+            continue;
+        }
+        r = &x->runs[n++];
+        r->dst = i;
+        r->src = src;
+        r->len = 1;
+    }
+    x->nruns = n;
+    return 0;
+}
+
+#ifdef XLATE_SSSE3
+/*
+ * One shuffle per whole 16 bytes of output, if each draws on 16 bytes
+ * of input at most.
+ */
+static int build_shuffles(struct xen_xlate *x, const int *map)
+{
+    unsigned int nchunks = x->dst_size / XLATE_CHUNK;
+    unsigned int c, i;
+
+    if (!nchunks || x->src_size < XLATE_CHUNK)
+        return -1;
+
+    x->chunk_src = calloc(nchunks, sizeof (*x->chunk_src));
+    x->shuf = calloc(nchunks, sizeof (*x->shuf));
+    if (!x->chunk_src || !x->shuf)
+        goto fail;
+
+    for (c = 0; c < nchunks; c++) {
+        const int *m = &map[c * XLATE_CHUNK];
+        int lo = INT_MAX, hi = -1;
+
+        for (i = 0; i < XLATE_CHUNK; i++) {
+            if (m[i] < 0)
+                continue;
+            if (m[i] < lo)
+                lo = m[i];
+            if (m[i] > hi)
+                hi = m[i];
+        }
+        if (hi == -1)
+            lo = 0;
+        else if (hi - lo >= XLATE_CHUNK)
+            goto fail;
+        if (lo + XLATE_CHUNK > (int)x->src_size)
+            lo = x->src_size - XLATE_CHUNK;
+
+        x->chunk_src[c] = lo;
+        for (i = 0; i < XLATE_CHUNK; i++)
+            x->shuf[c][i] = m[i] < 0 ? 0x80 : m[i] - lo;
+    }
+    x->nchunks = nchunks;
+    return 0;
+
+fail:
+    free(x->chunk_src);
+    free(x->shuf);
+    x->chunk_src = NULL;
+    x->shuf = NULL;
+    return -1;
+}
+#endif
+
+#ifdef XLATE_SSSE3
+/*
+ * A few long runs, typical of a layout that only shifts after the
+ * first 64 bit field, copy faster than they shuffle: keep the
+ * shuffles only if they come to fewer operations than the runs.
+ */
+static void try_shuffles(struct xen_xlate *x, const int *map)
+{
+    struct xlate_run *runs = x->runs;
+    unsigned int nruns = x->nruns;
+
+    if (build_shuffles(x, map))
+        return;
+
+    if (!build_runs(x, map, x->nchunks * XLATE_CHUNK, x->dst_size)) {
+        if (x->nchunks + x->nruns < nruns) {
+            free(runs);
+            x->fn = xlate_ssse3;
+            return;
+        }
+        free(x->runs);
+    }
+
+    x->runs = runs;
+    x->nruns = nruns;
+    x->nchunks = 0;
+    free(x->chunk_src);
+    free(x->shuf);
+    x->chunk_src = NULL;
+    x->shuf = NULL;
+}
+#endif
+
+/*
+ * The ABI the frontend of the device speaks, from the protocol node it
+ * wrote (the native one if none), or -1 if unknown.
+ */
+EXTERNAL int
+backend_ring_abi(xen_backend_t xenback, int devid)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!xendev->protocol)
+        return ABI_HOST;
+    if (!strcmp(xendev->protocol, "x86_32-abi"))
+        return XEN_ABI_X86_32;
+    if (!strcmp(xendev->protocol, "x86_64-abi"))
+        return XEN_ABI_X86_64;
+    return -1;
+}
+
+/* Whether translations created from now on may use SIMD, for comparison */
+EXTERNAL void
+backend_xlate_set_simd(int enable)
+{
+    xlate_simd = !!enable;
+}
+
+/*
+ * Translate between abi and the native layout, in direction dir, a
+ * request or response whose fields are described by fields (every byte
+ * not covered by a field being zeroed) and whose size is size32 or
+ * size64 in each ABI. Fails with ENOTSUP other than on x86, where there
+ * is nothing to translate.
+ */
+EXTERNAL xen_xlate_t
+backend_xlate_create(const struct xen_ring_field *fields,
+                     unsigned int size32, unsigned int size64,
+                     enum xen_ring_abi abi, enum xen_xlate_dir dir)
+{
+    struct xen_xlate *x;
+    const struct xen_ring_field *f;
+    unsigned int abi_size, native_size;
+    int *map = NULL;
+    unsigned int i;
+
+    if (ABI_HOST == XEN_ABI_NATIVE) {
+        errno = ENOTSUP;
+        return NULL;
+    }
+    if (abi == XEN_ABI_NATIVE)
+        abi = ABI_HOST;
+
+    abi_size = abi == XEN_ABI_X86_32 ? size32 : size64;
+    native_size = ABI_HOST == XEN_ABI_X86_32 ? size32 : size64;
+    if (!abi_size || abi_size > XLATE_SIZE_MAX ||
+        !native_size || native_size > XLATE_SIZE_MAX) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    x = calloc(1, sizeof (*x));
+    if (!x)
+        return NULL;
+
+    x->src_size = dir == XEN_XLATE_TO_NATIVE ? abi_size : native_size;
+    x->dst_size = dir == XEN_XLATE_TO_NATIVE ? native_size : abi_size;
+
+    if (abi == ABI_HOST) {
+        x->fn = xlate_copy;
+        return x;
+    }
+
+    map = malloc(x->dst_size * sizeof (*map));
+    if (!map)
+        goto fail;
+    for (i = 0; i < x->dst_size; i++)
+        map[i] = -1;
+
+    for (f = fields; f->size; f++) {
+        unsigned int off_abi = abi == XEN_ABI_X86_32 ? f->off32 : f->off64;
+        unsigned int off_nat = ABI_HOST == XEN_ABI_X86_32 ?
+                               f->off32 : f->off64;
+        unsigned int src = dir == XEN_XLATE_TO_NATIVE ? off_abi : off_nat;
+        unsigned int dst = dir == XEN_XLATE_TO_NATIVE ? off_nat : off_abi;
+
+        if (src + f->size > x->src_size || dst + f->size > x->dst_size) {
+            errno = EINVAL;
+            goto fail;
+        }
+        for (i = 0; i < f->size; i++)
+            map[dst + i] = src + i;
+    }
+
+    if (build_runs(x, map, 0, x->dst_size))
+        goto fail;
+    x->fn = xlate_scalar;
+#ifdef XLATE_SSSE3
+    if (xlate_simd && have_ssse3())
+        try_shuffles(x, map);
+#endif
+
+    free(map);
+    return x;
+
+fail:
+    free(map);
+    backend_xlate_free(x);
+    return NULL;
+}
+
+EXTERNAL void
+backend_xlate_free(xen_xlate_t x)
+{
+    if (!x)
+        return;
+    free(x->runs);
+    free(x->chunk_src);
+    free(x->shuf);
+    free(x);
+}
+
+/* Whether x translates with SIMD shuffles */
+EXTERNAL int
+backend_xlate_simd(xen_xlate_t x)
+{
+    return x->nchunks != 0;
+}
+
+/*
+ * Translate n consecutive requests (or responses) from src to dst,
+ * which must not overlap. Callers copy them off the shared ring first,
+ * as it is the frontend's to change under our feet.
+ */
+EXTERNAL void
+backend_xlate(xen_xlate_t x, void *dst, const void *src, unsigned int n)
+{
+    x->fn(x, dst, src, n);
+}
@@ -23,82 +23,253 @@
 
 
 INTERNAL int
-xs_write_str(const char *base, const char *node, const char *val)
+xs_write_str(struct xs_handle *xsh, const char *base, const char *node,
+             const char *val)
 {
     char abspath[PATH_BUFSZ];
 
     snprintf(abspath, sizeof(abspath), "%s/%s", base, node);
-    if (!xs_write(xs_handle, 0, abspath, val, strlen(val)))
+    if (!xs_write(xsh, 0, abspath, val, strlen(val)))
 	return -1;
     return 0;
 }
 
 INTERNAL char *
-xs_read_str(const char *base, const char *node)
+xs_read_str_len(struct xs_handle *xsh, const char *base, const char *node,
+                unsigned int *len)
 {
     char abspath[PATH_BUFSZ];
-    unsigned int len;
 
     snprintf(abspath, sizeof(abspath), "%s/%s", base, node);
-    return xs_read(xs_handle, 0, abspath, &len);
+    return xs_read(xsh, 0, abspath, len);
+}
+
+INTERNAL char *
+xs_read_str(struct xs_handle *xsh, const char *base, const char *node)
+{
+    unsigned int len;
+
+    return xs_read_str_len(xsh, base, node, &len);
+}
+
+/*
+ * Copy the value of base/node into a caller supplied buffer. This is
+ * for the callers' convenience only: xs_read() still allocates the
+ * value, which is copied and freed here. Returns the length of the
+ * value, or -1 if the node cannot be read or does not fit.
+ */
+INTERNAL int
+xs_read_buf(struct xs_handle *xsh, const char *base, const char *node,
+            char *buf, unsigned int sz)
+{
+    char *val;
+    unsigned int len;
+
+    val = xs_read_str_len(xsh, base, node, &len);
+    if (!val)
+        return -1;
+    if (len >= sz) {
+        free(val);
+        return -1;
+    }
+    memcpy(buf, val, len);
+    buf[len] = '\0';
+    free(val);
+
+    return len;
 }
 
+/*
+ * Equivalent of sscanf(val, "%d", ival) for the values we find in
+ * xenstore, minus the format string interpretation.
+ */
 INTERNAL int
-xs_write_int(const char *base, const char *node, int ival)
+xs_parse_int(const char *val, int *ival)
+{
+    long v = 0;
+    int neg = 0;
+    const char *p = val;
+
+    while (*p == ' ' || *p == '\t' || *p == '\n')
+        p++;
+    if (*p == '-' || *p == '+')
+        neg = (*p++ == '-');
+    if (*p < '0' || *p > '9')
+        return -1;
+    while (*p >= '0' && *p <= '9') {
+        v = v * 10 + (*p++ - '0');
+        if (v > (long)INT_MAX + 1)
+            return -1;
+    }
+    if (neg)
+        v = -v;
+    if (v > INT_MAX)
+        return -1;
+
+    *ival = v;
+    return 0;
+}
+
+INTERNAL int
+xs_parse_ulong(const char *val, unsigned long *lval)
+{
+    unsigned long v = 0;
+    const char *p = val;
+
+    while (*p == ' ' || *p == '\t' || *p == '\n')
+        p++;
+    if (*p < '0' || *p > '9')
+        return -1;
+    while (*p >= '0' && *p <= '9') {
+        unsigned long d = *p++ - '0';
+
+        if (v > (ULONG_MAX - d) / 10)
+            return -1;
+        v = v * 10 + d;
+    }
+
+    *lval = v;
+    return 0;
+}
+
+INTERNAL int
+xs_write_int(struct xs_handle *xsh, const char *base, const char *node,
+             int ival)
 {
     char val[32];
 
     snprintf(val, sizeof(val), "%d", ival);
-    return xs_write_str(base, node, val);
+    return xs_write_str(xsh, base, node, val);
 }
 
 INTERNAL int
-xs_read_int(const char *base, const char *node, int *ival)
+xs_read_int(struct xs_handle *xsh, const char *base, const char *node,
+            int *ival)
 {
-    char *val;
-    int rc = -1;
+    char val[32];
 
-    val = xs_read_str(base, node);
-    if (val && 1 == sscanf(val, "%d", ival))
-	rc = 0;
-    free(val);
-    return rc;
+    if (xs_read_buf(xsh, base, node, val, sizeof (val)) < 0)
+        return -1;
+    return xs_parse_int(val, ival);
+}
+
+/* buf must be PATH_BUFSZ long */
+INTERNAL const char *
+xs_be_path(struct xen_device *xendev, char *buf)
+{
+    struct xen_backend *xenback = xendev->backend;
+
+    snprintf(buf, PATH_BUFSZ, "%s/%d", xenback->path, xendev->devid);
+    return buf;
 }
 
 INTERNAL int
 xs_write_be_str(struct xen_device *xendev, const char *node, const char *val)
 {
-    return xs_write_str(xendev->be, node, val);
+    char be[PATH_BUFSZ];
+
+    if (!wc_write(xendev, node, val))
+        return 0;
+    return xs_write_str(xendev->backend->xsh, xs_be_path(xendev, be), node,
+                        val);
 }
 
 INTERNAL int
 xs_write_be_int(struct xen_device *xendev, const char *node, int ival)
 {
-    return xs_write_int(xendev->be, node, ival);
+    char val[32];
+
+    snprintf(val, sizeof(val), "%d", ival);
+    return xs_write_be_str(xendev, node, val);
 }
 
 INTERNAL char *
 xs_read_be_str(struct xen_device *xendev, const char *node)
 {
-    return xs_read_str(xendev->be, node);
+    char be[PATH_BUFSZ];
+    const char *val;
+
+    val = wc_pending(xendev, node);
+    if (val)
+        return strdup(val);
+    return xs_read_str(xendev->backend->xsh, xs_be_path(xendev, be), node);
 }
 
 INTERNAL int
 xs_read_be_int(struct xen_device *xendev, const char *node, int *ival)
 {
-    return xs_read_int(xendev->be, node, ival);
+    char be[PATH_BUFSZ];
+    const char *val;
+
+    val = wc_pending(xendev, node);
+    if (val)
+        return xs_parse_int(val, ival);
+    return xs_read_int(xendev->backend->xsh, xs_be_path(xendev, be), node,
+                       ival);
 }
 
 INTERNAL char *
 xs_read_fe_str(struct xen_device *xendev, const char *node)
 {
-    return xs_read_str(xendev->fe, node);
+    return xs_read_str(xendev->backend->xsh, xendev->fe, node);
 }
 
 INTERNAL int
 xs_read_fe_int(struct xen_device *xendev, const char *node, int *ival)
 {
-    return xs_read_int(xendev->fe, node, ival);
+    return xs_read_int(xendev->backend->xsh, xendev->fe, node, ival);
+}
+
+EXTERNAL int
+backend_read(xen_backend_t xenback, int devid, const char *node,
+             char *buf, unsigned int len)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+    char be[PATH_BUFSZ];
+    const char *val;
+    size_t n;
+
+    val = wc_pending(xendev, node);
+    if (val) {
+        n = strlen(val);
+        if (n >= len)
+            return -1;
+        memcpy(buf, val, n + 1);
+        return n;
+    }
+    return xs_read_buf(xenback->xsh, xs_be_path(xendev, be), node, buf,
+                       len);
+}
+
+EXTERNAL int
+frontend_read(xen_backend_t xenback, int devid, const char *node,
+              char *buf, unsigned int len)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!xendev->fe)
+        return -1;
+    return xs_read_buf(xenback->xsh, xendev->fe, node, buf, len);
+}
+
+EXTERNAL int
+backend_read_int(xen_backend_t xenback, int devid, const char *node,
+                 int *ival)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    return xs_read_be_int(xendev, node, ival);
+}
+
+EXTERNAL int
+frontend_read_int(xen_backend_t xenback, int devid, const char *node,
+                  int *ival)
+{
+    struct xen_device *xendev = &xenback->devices[devid];
+
+    if (!xendev->fe)
+        return -1;
+    return xs_read_fe_int(xendev, node, ival);
 }
 
 EXTERNAL int
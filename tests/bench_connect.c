@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Time from a frontend switching to Initialised to its backend being
+ * Connected, and the xenstore requests made in between, with xenstore
+ * round trips and hypercalls made to take a set time:
+ *
+ *  - callback: the connect callback maps the ring and binds the port,
+ *    reading page-ref and event-channel;
+ *  - auto, batched: auto-connect, the backend seeing the frontend's
+ *    writes only once it is Initialised;
+ *  - auto, as written: auto-connect, the backend seeing each write as
+ *    it is made, so the mapping and binding overlap with the frontend.
+ *
+ *   bench_connect [rounds [xenstore_us [hypercall_us]]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xenbackend.h>
+#include <xen/io/xenbus.h>
+
+#include "fake_xen.h"
+
+#define DEVICES         16
+
+struct bench_dev
+{
+    xen_backend_t       xenback;
+    int                 devid;
+    void                *ring;
+};
+
+static xen_device_t bench_alloc(xen_backend_t xenback, int devid,
+                                backend_private_t priv)
+{
+    struct bench_dev *d = calloc(1, sizeof (*d));
+
+    if (d) {
+        d->xenback = xenback;
+        d->devid = devid;
+    }
+    return d;
+}
+
+static int bench_connect(xen_device_t dev)
+{
+    struct bench_dev *d = dev;
+
+    d->ring = backend_map_shared_page(d->xenback, d->devid);
+    if (!d->ring)
+        return -1;
+    if (backend_bind_evtchn(d->xenback, d->devid) == -1)
+        return -1;
+    return 0;
+}
+
+static void bench_disconnect(xen_device_t dev)
+{
+    struct bench_dev *d = dev;
+
+    backend_unbind_evtchn(d->xenback, d->devid);
+    if (d->ring)
+        backend_unmap_shared_page(d->xenback, d->devid, d->ring);
+    d->ring = NULL;
+}
+
+static void bench_free(xen_device_t dev)
+{
+    free(dev);
+}
+
+static struct xen_backend_ops bench_ops = {
+    bench_alloc,
+    NULL,
+    bench_connect,
+    bench_disconnect,
+    NULL,
+    NULL,
+    NULL,
+    bench_free,
+};
+
+enum mode
+{
+    MODE_CALLBACK,
+    MODE_AUTO_BATCHED,
+    MODE_AUTO,
+};
+
+static const char *mode_names[] = {
+    "callback",
+    "auto, batched",
+    "auto, as written",
+};
+
+static void fe_write(int domid, int devid, const char *node, int val,
+                     int run)
+{
+    char path[128];
+
+    snprintf(path, sizeof (path), "/local/domain/%d/device/vif/%d/%s",
+             domid, devid, node);
+    fake_xs_printf(path, "%d", val);
+    if (run)
+        fake_xs_run();
+}
+
+static int round_trip(enum mode mode, int domid, unsigned long long *ns,
+                      unsigned long *requests)
+{
+    char path[128];
+    xen_backend_t xenback;
+    unsigned long long start;
+    unsigned long r;
+    int as_written = mode != MODE_AUTO_BATCHED;
+    int state;
+    int i;
+
+    for (i = 0; i < DEVICES; i++)
+        fake_xs_add_device("vif", domid, i);
+
+    xenback = backend_register("vif", domid, &bench_ops, NULL);
+    if (!xenback)
+        return -1;
+    if (mode != MODE_CALLBACK && backend_set_auto_connect(xenback, 1))
+        return -1;
+    fake_xs_run();
+
+    for (i = 0; i < DEVICES; i++) {
+        fe_write(domid, i, "page-ref", 1000 + i, as_written);
+        fe_write(domid, i, "event-channel", 10 + i, as_written);
+
+        r = fake_xs_requests;
+        start = fake_now_ns();
+        fe_write(domid, i, "state", XenbusStateInitialised, 1);
+        *ns += fake_now_ns() - start;
+        *requests += fake_xs_requests - r;
+
+        snprintf(path, sizeof (path), "/local/domain/0/backend/vif/%d/%d/state",
+                 domid, i);
+        if (fake_xs_read_int(path, &state) || state != XenbusStateConnected)
+            return -1;
+    }
+
+    backend_release(xenback);
+
+    snprintf(path, sizeof (path), "/local/domain/0/backend/vif/%d", domid);
+    fake_xs_rm(path);
+    snprintf(path, sizeof (path), "/local/domain/%d", domid);
+    fake_xs_rm(path);
+    fake_xs_run();
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int rounds = argc > 1 ? atoi(argv[1]) : 20;
+    unsigned int xs_us = argc > 2 ? atoi(argv[2]) : 20;
+    unsigned int xc_us = argc > 3 ? atoi(argv[3]) : 10;
+    int domid = 1;
+    int mode;
+    int i;
+
+    if (rounds <= 0 || backend_init(0))
+        return 1;
+
+    fake_xs_set_latency(xs_us);
+    fake_xc_set_latency(xc_us);
+    printf("xenstore round trip %u us, hypercall %u us\n", xs_us, xc_us);
+
+    for (mode = MODE_CALLBACK; mode <= MODE_AUTO; mode++) {
+        unsigned long long ns = 0;
+        unsigned long requests = 0;
+
+        for (i = 0; i < rounds; i++) {
+            if (round_trip(mode, domid++, &ns, &requests)) {
+                printf("%s: handshake failed\n", mode_names[mode]);
+                return 1;
+            }
+        }
+        printf("%-17s Initialised to Connected %6.1f us, "
+               "%.2f xenstore requests\n", mode_names[mode],
+               (double)ns / 1000 / (rounds * DEVICES),
+               (double)requests / (rounds * DEVICES));
+    }
+
+    backend_close();
+    return 0;
+}
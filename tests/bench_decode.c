@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Per event cost of decoding watch paths and tokens, against the
+ * sscanf() and strlen() based decoding the watch handler used before.
+ *
+ *   bench_decode [iterations]
+ */
+
+#include "project.h"
+#include "backend.h"
+
+#include "fake_xen.h"
+
+#define BE_PATH         "/local/domain/0/backend/vbd/7"
+#define FE_PATH         "/local/domain/7/device/vbd/51712"
+
+static volatile unsigned long sink;
+
+/* The decoding replaced, as it was */
+static int old_devid_from_path(struct xen_backend *xenback, char *path)
+{
+    int devid;
+    int rc;
+    char dummy[PATH_BUFSZ];
+
+    rc = sscanf(path + xenback->path_len, "/%d/%255s", &devid, dummy);
+    if (rc == 2)
+        return devid;
+
+    rc = sscanf(path + xenback->path_len, "/%d", &devid);
+    if (rc == 1)
+        return devid;
+
+    return -1;
+}
+
+static char *old_node_from_path(const char *base, char *path)
+{
+    int len = strlen(base);
+
+    if (strncmp(base, path, len))
+        return NULL;
+    if (path[len] != '/')
+        return NULL;
+
+    return path + len + 1;
+}
+
+static void *old_token(const char *token)
+{
+    void *p;
+
+    if (sscanf(token, MAGIC_STRING"%p", &p) != 1)
+        return NULL;
+    return p;
+}
+
+static void report(const char *what, unsigned long long old_ns,
+                   unsigned long long new_ns, int n)
+{
+    printf("%-14s sscanf/strlen %6.1f ns, now %6.1f ns (%.1fx)\n",
+           what, (double)old_ns / n, (double)new_ns / n,
+           (double)old_ns / new_ns);
+}
+
+int main(int argc, char **argv)
+{
+    static struct xen_backend xenback;
+    struct xen_device *xendev = &xenback.devices[3];
+    char be_path[] = BE_PATH "/3/feature-flush-cache";
+    char fe_path[] = FE_PATH "/ring-ref";
+    char token[TOKEN_BUFSZ];
+    unsigned long long t0, t1, t2;
+    char *node;
+    int n = argc > 1 ? atoi(argv[1]) : 1000000;
+    int i;
+
+    if (n <= 0)
+        return 1;
+
+    xenback.path = BE_PATH;
+    xenback.path_len = strlen(BE_PATH);
+    xendev->fe = FE_PATH;
+    xendev->fe_len = strlen(FE_PATH);
+    snprintf(token, sizeof (token), MAGIC_STRING"%p", xendev);
+
+    if (decode_backend_path(&xenback, be_path, &node) != 3 ||
+        old_devid_from_path(&xenback, be_path) != 3 ||
+        decode_frontend_path(xendev, fe_path) !=
+        old_node_from_path(xendev->fe, fe_path) ||
+        decode_token(token) != xendev || old_token(token) != xendev)
+        return 1;
+
+    t0 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += old_devid_from_path(&xenback, be_path);
+    t1 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += decode_backend_path(&xenback, be_path, &node);
+    t2 = fake_now_ns();
+    report("backend path", t1 - t0, t2 - t1, n);
+
+    t0 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += (unsigned long)old_node_from_path(xendev->fe, fe_path);
+    t1 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += (unsigned long)decode_frontend_path(xendev, fe_path);
+    t2 = fake_now_ns();
+    report("frontend path", t1 - t0, t2 - t1, n);
+
+    t0 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += (unsigned long)old_token(token);
+    t1 = fake_now_ns();
+    for (i = 0; i < n; i++)
+        sink += (unsigned long)decode_token(token);
+    t2 = fake_now_ns();
+    report("token", t1 - t0, t2 - t1, n);
+
+    return 0;
+}
@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Cost of a watch event for a changed node, and the allocations made
+ * while handling it: those of libxenstore (the watch event and the
+ * value read, malloc'd by its API) and whatever libxenbackend adds.
+ *
+ *   bench_watch [events]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <xenbackend.h>
+
+#include "fake_xen.h"
+
+#define DEVICES 4
+
+#ifdef __GLIBC__
+/* Count every allocation made in the process */
+static unsigned long mallocs = 0;
+
+extern void *__libc_malloc(size_t sz);
+extern void *__libc_calloc(size_t n, size_t sz);
+extern void *__libc_realloc(void *p, size_t sz);
+
+void *malloc(size_t sz)
+{
+    mallocs++;
+    return __libc_malloc(sz);
+}
+
+void *calloc(size_t n, size_t sz)
+{
+    mallocs++;
+    return __libc_calloc(n, sz);
+}
+
+void *realloc(void *p, size_t sz)
+{
+    mallocs++;
+    return __libc_realloc(p, sz);
+}
+#endif
+
+static unsigned long changes = 0;
+
+static xen_device_t bench_alloc(xen_backend_t xenback, int devid,
+                                backend_private_t priv)
+{
+    return (xen_device_t)(long)(devid + 1);
+}
+
+static void bench_changed(xen_device_t dev, const char *node,
+                          const char *val)
+{
+    changes++;
+}
+
+static struct xen_backend_ops bench_ops = {
+    bench_alloc,
+    NULL,
+    NULL,
+    NULL,
+    bench_changed,
+    bench_changed,
+    NULL,
+    NULL,
+};
+
+static void run(const char *what, const char *fmt, int events)
+{
+    char path[256];
+    unsigned long long start;
+    unsigned long a;
+#ifdef __GLIBC__
+    unsigned long m;
+#endif
+    int handled = 0;
+    int i;
+
+    fake_xs_run();
+
+#ifdef __GLIBC__
+    m = mallocs;
+#endif
+    a = fake_xs_allocs;
+    start = fake_now_ns();
+    for (i = 0; i < events; i++) {
+        snprintf(path, sizeof (path), fmt, i % DEVICES);
+        fake_xs_printf(path, "%d", i);
+        handled += fake_xs_run();
+    }
+
+#ifdef __GLIBC__
+    printf("%-14s %d events, %llu ns/event, allocations/event: "
+           "%.2f libxenstore, %.2f libxenbackend\n",
+           what, handled, (fake_now_ns() - start) / handled,
+           (double)(fake_xs_allocs - a) / handled,
+           (double)((mallocs - m) - (fake_xs_allocs - a)) / handled);
+#else
+    printf("%-14s %d events, %llu ns/event, allocations/event: "
+           "%.2f libxenstore\n",
+           what, handled, (fake_now_ns() - start) / handled,
+           (double)(fake_xs_allocs - a) / handled);
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    xen_backend_t xenback;
+    int events = argc > 1 ? atoi(argv[1]) : 100000;
+    int i;
+
+    if (events <= 0 || backend_init(0))
+        return 1;
+
+    for (i = 0; i < DEVICES; i++)
+        fake_xs_add_device("vbd", 1, i);
+
+    xenback = backend_register("vbd", 1, &bench_ops, NULL);
+    if (!xenback)
+        return 1;
+
+    run("frontend node", "/local/domain/1/device/vbd/%d/feature", events);
+    run("backend node", "/local/domain/0/backend/vbd/1/%d/feature", events);
+
+    backend_release(xenback);
+    backend_close();
+
+    return changes ? 0 : 1;
+}
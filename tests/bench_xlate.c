@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Cost of translating requests from the x86_32 ABI, with SIMD shuffles
+ * and with scalar runs of bytes, and a check that both agree. Two
+ * layouts: blkif's, which only shifts once and which the library
+ * keeps translating with runs, and one of alternating 32 and 64 bit
+ * fields, which breaks into many short runs.
+ *
+ *   bench_xlate [batches]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <xenbackend.h>
+
+#include "fake_xen.h"
+
+#define BATCH           32              /* requests per batch */
+#define SIZE_MAX32      128
+#define SIZE_MAX64      128
+
+/* struct blkif_request, 11 segments of 8 bytes */
+static const struct xen_ring_field blkif_fields[] = {
+    { 0,  0,  1 },                      /* operation */
+    { 1,  1,  1 },                      /* nr_segments */
+    { 2,  2,  2 },                      /* handle */
+    { 4,  8,  8 },                      /* id */
+    { 12, 16, 8 },                      /* sector_number */
+    { 20, 24, 88 },                     /* seg[] */
+    { 0,  0,  0 },
+};
+
+/* 8 pairs of a 32 bit field followed by a 64 bit one */
+static const struct xen_ring_field mixed_fields[] = {
+    { 0,  0,  4 }, { 4,  8,  8 },
+    { 12, 16, 4 }, { 16, 24, 8 },
+    { 24, 32, 4 }, { 28, 40, 8 },
+    { 36, 48, 4 }, { 40, 56, 8 },
+    { 48, 64, 4 }, { 52, 72, 8 },
+    { 60, 80, 4 }, { 64, 88, 8 },
+    { 72, 96, 4 }, { 76, 104, 8 },
+    { 84, 112, 4 }, { 88, 120, 8 },
+    { 0,  0,  0 },
+};
+
+static unsigned char src[BATCH * SIZE_MAX32];
+static unsigned char dst[2][BATCH * SIZE_MAX64];
+
+static unsigned long long run(xen_xlate_t x, unsigned char *out, int batches)
+{
+    unsigned long long start = fake_now_ns();
+    int i;
+
+    for (i = 0; i < batches; i++)
+        backend_xlate(x, out, src, BATCH);
+
+    return fake_now_ns() - start;
+}
+
+static int bench(const char *what, const struct xen_ring_field *fields,
+                 unsigned int size32, unsigned int size64, int batches)
+{
+    xen_xlate_t x[2];
+    unsigned long long ns[2];
+    int simd;
+
+    memset(dst, 0, sizeof (dst));
+
+    for (simd = 0; simd < 2; simd++) {
+        backend_xlate_set_simd(simd);
+        x[simd] = backend_xlate_create(fields, size32, size64,
+                                       XEN_ABI_X86_32, XEN_XLATE_TO_NATIVE);
+        if (!x[simd]) {
+            perror("backend_xlate_create");
+            return -1;
+        }
+        ns[simd] = run(x[simd], dst[simd], batches);
+    }
+
+    printf("%-6s scalar %5.1f ns/request, default %5.1f ns/request "
+           "(%s, %.1fx)\n", what,
+           (double)ns[0] / batches / BATCH, (double)ns[1] / batches / BATCH,
+           backend_xlate_simd(x[1]) ? "SIMD" : "scalar",
+           (double)ns[0] / ns[1]);
+
+    backend_xlate_free(x[0]);
+    backend_xlate_free(x[1]);
+
+    if (memcmp(dst[0], dst[1], sizeof (dst[0]))) {
+        printf("%s: scalar and SIMD translations differ\n", what);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int batches = argc > 1 ? atoi(argv[1]) : 100000;
+    unsigned int i;
+
+    if (batches <= 0)
+        return 1;
+
+    for (i = 0; i < sizeof (src); i++)
+        src[i] = i * 7 + 1;
+
+    if (bench("blkif", blkif_fields, 108, 112, batches) ||
+        bench("mixed", mixed_fields, 96, 128, batches))
+        return 1;
+
+    return 0;
+}
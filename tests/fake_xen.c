@@ -0,0 +1,653 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include <xenctrl.h>
+#include <xs.h>
+#include <xen/io/xenbus.h>
+
+#include <xenbackend.h>
+
+#include "fake_xen.h"
+
+#define NODES_MAX       16384
+#define NODE_PATHSZ     256
+#define NODE_VALSZ      128
+#define HASH_SZ         4096
+#define WATCHES_MAX     1024
+#define EVENTS_MAX      4096
+#define TOKENSZ         64
+
+struct node
+{
+    int                 next;           /* hash chain, -1 terminated */
+    unsigned int        len;
+    char                path[NODE_PATHSZ];
+    char                val[NODE_VALSZ];
+};
+
+struct watch
+{
+    char                path[NODE_PATHSZ];
+    char                token[TOKENSZ];
+};
+
+struct event
+{
+    char                path[NODE_PATHSZ];
+    char                token[TOKENSZ];
+};
+
+struct xs_handle
+{
+    struct xs_handle    *next;
+    int                 fd;
+    struct watch        watches[WATCHES_MAX];
+    unsigned int        nwatches;
+    struct event        events[EVENTS_MAX];
+    unsigned int        head, tail;
+};
+
+unsigned long fake_xs_requests = 0;
+unsigned long fake_xs_allocs = 0;
+
+static struct node nodes[NODES_MAX];
+static int free_node = -1;
+static int nnodes = 0;
+static int buckets[HASH_SZ];
+static int buckets_init = 0;
+static struct xs_handle *handles = NULL;
+static unsigned int latency_us = 0;
+static unsigned int xc_latency_us = 0;
+static xs_transaction_t next_transaction = 1;
+
+unsigned long long fake_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void fake_xs_set_latency(unsigned int us)
+{
+    latency_us = us;
+}
+
+void fake_xc_set_latency(unsigned int us)
+{
+    xc_latency_us = us;
+}
+
+static void spin(unsigned int us)
+{
+    unsigned long long until;
+
+    if (!us)
+        return;
+    until = fake_now_ns() + us * 1000ULL;
+    while (fake_now_ns() < until)
+        ;
+}
+
+/* One request to the store: count it and wait for the round trip */
+static void request(void)
+{
+    fake_xs_requests++;
+    spin(latency_us);
+}
+
+static void *fake_alloc(size_t sz)
+{
+    fake_xs_allocs++;
+    return malloc(sz);
+}
+
+static unsigned int hash(const char *path)
+{
+    unsigned int h = 5381;
+
+    while (*path)
+        h = h * 33 + (unsigned char)*path++;
+    return h % HASH_SZ;
+}
+
+static int lookup(const char *path, int **link)
+{
+    int *l;
+    int i;
+
+    if (!buckets_init) {
+        for (i = 0; i < HASH_SZ; i++)
+            buckets[i] = -1;
+        buckets_init = 1;
+    }
+
+    for (l = &buckets[hash(path)]; *l != -1; l = &nodes[*l].next)
+        if (!strcmp(nodes[*l].path, path))
+            break;
+    if (link)
+        *link = l;
+    return *l;
+}
+
+/* Watch events go to every connection watching path or a parent of it */
+static void fire(const char *path)
+{
+    struct xs_handle *h;
+    size_t len;
+    unsigned int i;
+    uint64_t one = 1;
+
+    for (h = handles; h; h = h->next) {
+        for (i = 0; i < h->nwatches; i++) {
+            struct event *ev;
+
+            len = strlen(h->watches[i].path);
+            if (strncmp(path, h->watches[i].path, len) ||
+                (path[len] != '\0' && path[len] != '/'))
+                continue;
+            if (h->tail - h->head == EVENTS_MAX)
+                continue;
+            ev = &h->events[h->tail++ % EVENTS_MAX];
+            snprintf(ev->path, sizeof (ev->path), "%s", path);
+            memcpy(ev->token, h->watches[i].token, sizeof (ev->token));
+            if (write(h->fd, &one, sizeof (one)) != sizeof (one))
+                continue;
+        }
+    }
+}
+
+static int store(const char *path, const void *data, unsigned int len)
+{
+    int *link;
+    int n;
+
+    if (strlen(path) >= NODE_PATHSZ || len >= NODE_VALSZ) {
+        errno = E2BIG;
+        return -1;
+    }
+
+    n = lookup(path, &link);
+    if (n == -1) {
+        if (free_node != -1) {
+            n = free_node;
+            free_node = nodes[n].next;
+        } else if (nnodes < NODES_MAX) {
+            n = nnodes++;
+        } else {
+            errno = ENOSPC;
+            return -1;
+        }
+        strcpy(nodes[n].path, path);
+        nodes[n].next = -1;
+        *link = n;
+    }
+    memcpy(nodes[n].val, data, len);
+    nodes[n].val[len] = '\0';
+    nodes[n].len = len;
+
+    fire(path);
+    return 0;
+}
+
+static const char *component_end(const char *p)
+{
+    while (*p && *p != '/')
+        p++;
+    return p;
+}
+
+static int is_below(const char *path, const char *dir, size_t len)
+{
+    return !strncmp(path, dir, len) && (path[len] == '/' || path[len] == '\0');
+}
+
+static int remove_tree(const char *path)
+{
+    size_t len = strlen(path);
+    int removed = 0;
+    int i;
+
+    for (i = 0; i < nnodes; i++) {
+        int *link;
+
+        if (!nodes[i].path[0] || !is_below(nodes[i].path, path, len))
+            continue;
+        lookup(nodes[i].path, &link);
+        *link = nodes[i].next;
+        nodes[i].path[0] = '\0';
+        nodes[i].next = free_node;
+        free_node = i;
+        removed++;
+    }
+    if (!removed) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    fire(path);
+    return 0;
+}
+
+int fake_xs_printf(const char *path, const char *fmt, ...)
+{
+    char val[NODE_VALSZ];
+    va_list ap;
+    int len;
+
+    va_start(ap, fmt);
+    len = vsnprintf(val, sizeof (val), fmt, ap);
+    va_end(ap);
+    if (len < 0 || len >= (int)sizeof (val))
+        return -1;
+
+    return store(path, val, len);
+}
+
+int fake_xs_rm(const char *path)
+{
+    return remove_tree(path);
+}
+
+int fake_xs_read_int(const char *path, int *val)
+{
+    int n = lookup(path, NULL);
+
+    if (n == -1)
+        return -1;
+    *val = atoi(nodes[n].val);
+    return 0;
+}
+
+int fake_xs_add_device(const char *type, int domid, int devid)
+{
+    char be[NODE_PATHSZ / 2], fe[NODE_PATHSZ / 2], path[NODE_PATHSZ];
+
+    snprintf(be, sizeof (be), "/local/domain/0/backend/%s/%d/%d",
+             type, domid, devid);
+    snprintf(fe, sizeof (fe), "/local/domain/%d/device/%s/%d",
+             domid, type, devid);
+
+    snprintf(path, sizeof (path), "%s/backend", fe);
+    if (fake_xs_printf(path, "%s", be))
+        return -1;
+    snprintf(path, sizeof (path), "%s/state", fe);
+    if (fake_xs_printf(path, "%d", XenbusStateInitialising))
+        return -1;
+
+    snprintf(path, sizeof (path), "%s/frontend", be);
+    if (fake_xs_printf(path, "%s", fe))
+        return -1;
+    snprintf(path, sizeof (path), "%s/online", be);
+    if (fake_xs_printf(path, "1"))
+        return -1;
+    snprintf(path, sizeof (path), "%s/state", be);
+    return fake_xs_printf(path, "%d", XenbusStateInitialising);
+}
+
+int fake_xs_run(void)
+{
+    struct xs_handle *h;
+    int count = 0;
+
+    /* The library opens a single connection */
+    for (;;) {
+        for (h = handles; h && h->head == h->tail; h = h->next)
+            ;
+        if (!h)
+            break;
+        backend_xenstore_handler(NULL);
+        count++;
+    }
+
+    return count;
+}
+
+/* libxenstore */
+
+struct xs_handle *xs_open(unsigned long flags)
+{
+    struct xs_handle *h;
+
+    h = fake_alloc(sizeof (*h));
+    if (!h)
+        return NULL;
+    memset(h, 0, sizeof (*h));
+    h->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    h->next = handles;
+    handles = h;
+
+    return h;
+}
+
+void xs_daemon_close(struct xs_handle *h)
+{
+    struct xs_handle **p;
+
+    for (p = &handles; *p; p = &(*p)->next) {
+        if (*p == h) {
+            *p = h->next;
+            break;
+        }
+    }
+    close(h->fd);
+    free(h);
+}
+
+void xs_close(struct xs_handle *h)
+{
+    xs_daemon_close(h);
+}
+
+int xs_fileno(struct xs_handle *h)
+{
+    return h->fd;
+}
+
+char *xs_get_domain_path(struct xs_handle *h, unsigned int domid)
+{
+    char *path;
+
+    request();
+    path = fake_alloc(32);
+    if (path)
+        snprintf(path, 32, "/local/domain/%u", domid);
+    return path;
+}
+
+void *xs_read(struct xs_handle *h, xs_transaction_t t, const char *path,
+              unsigned int *len)
+{
+    char *val;
+    int n;
+
+    request();
+    n = lookup(path, NULL);
+    if (n == -1) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    /* libxenstore hands back a malloc'd copy, so do we */
+    val = fake_alloc(nodes[n].len + 1);
+    if (!val)
+        return NULL;
+    memcpy(val, nodes[n].val, nodes[n].len + 1);
+    if (len)
+        *len = nodes[n].len;
+    return val;
+}
+
+bool xs_write(struct xs_handle *h, xs_transaction_t t, const char *path,
+              const void *data, unsigned int len)
+{
+    request();
+    return !store(path, data, len);
+}
+
+bool xs_rm(struct xs_handle *h, xs_transaction_t t, const char *path)
+{
+    request();
+    return !remove_tree(path);
+}
+
+char **xs_directory(struct xs_handle *h, xs_transaction_t t,
+                    const char *path, unsigned int *num)
+{
+    size_t len = strlen(path);
+    size_t sz = 0;
+    unsigned int count = 0;
+    char **dir;
+    char *p;
+    int found = 0;
+    int i, j;
+
+    request();
+
+    /* Names of the children, as one block like libxenstore's */
+    for (i = 0; i < nnodes; i++) {
+        const char *name = nodes[i].path + len + 1;
+        const char *end;
+
+        if (!nodes[i].path[0] || !is_below(nodes[i].path, path, len))
+            continue;
+        found = 1;
+        if (nodes[i].path[len] == '\0')
+            continue;
+        end = component_end(name);
+        for (j = 0; j < i; j++)
+            if (nodes[j].path[0] && is_below(nodes[j].path, path, len) &&
+                nodes[j].path[len] == '/' &&
+                !strncmp(nodes[j].path + len + 1, name, end - name) &&
+                (nodes[j].path[len + 1 + (end - name)] == '/' ||
+                 nodes[j].path[len + 1 + (end - name)] == '\0'))
+                break;
+        if (j < i)
+            continue;
+        count++;
+        sz += end - name + 1;
+    }
+    if (!found) {
+        errno = ENOENT;
+        return NULL;
+    }
+
+    dir = fake_alloc(count * sizeof (char *) + sz + 1);
+    if (!dir)
+        return NULL;
+    p = (char *)(dir + count);
+    count = 0;
+    for (i = 0; i < nnodes; i++) {
+        const char *name = nodes[i].path + len + 1;
+        const char *end;
+
+        if (!nodes[i].path[0] || !is_below(nodes[i].path, path, len) ||
+            nodes[i].path[len] == '\0')
+            continue;
+        end = component_end(name);
+        for (j = 0; j < (int)count; j++)
+            if (!strncmp(dir[j], name, end - name) &&
+                dir[j][end - name] == '\0')
+                break;
+        if (j < (int)count)
+            continue;
+        dir[count++] = p;
+        memcpy(p, name, end - name);
+        p[end - name] = '\0';
+        p += end - name + 1;
+    }
+
+    *num = count;
+    return dir;
+}
+
+bool xs_watch(struct xs_handle *h, const char *path, const char *token)
+{
+    struct watch *w;
+    struct event *ev;
+    uint64_t one = 1;
+
+    request();
+    if (h->nwatches == WATCHES_MAX) {
+        errno = ENOSPC;
+        return false;
+    }
+    w = &h->watches[h->nwatches++];
+    snprintf(w->path, sizeof (w->path), "%s", path);
+    snprintf(w->token, sizeof (w->token), "%s", token);
+
+    /* xenstored fires a new watch once straight away */
+    if (h->tail - h->head < EVENTS_MAX) {
+        ev = &h->events[h->tail++ % EVENTS_MAX];
+        memcpy(ev->path, w->path, sizeof (ev->path));
+        memcpy(ev->token, w->token, sizeof (ev->token));
+        if (write(h->fd, &one, sizeof (one)) != sizeof (one))
+            return true;
+    }
+    return true;
+}
+
+bool xs_unwatch(struct xs_handle *h, const char *path, const char *token)
+{
+    unsigned int i;
+
+    request();
+    for (i = 0; i < h->nwatches; i++) {
+        if (strcmp(h->watches[i].path, path) ||
+            strcmp(h->watches[i].token, token))
+            continue;
+        h->watches[i] = h->watches[--h->nwatches];
+        return true;
+    }
+    errno = ENOENT;
+    return false;
+}
+
+char **xs_read_watch(struct xs_handle *h, unsigned int *num)
+{
+    struct event *ev;
+    size_t plen, tlen;
+    char **w;
+    uint64_t v;
+
+    if (h->head == h->tail) {
+        errno = EAGAIN;
+        return NULL;
+    }
+    ev = &h->events[h->head++ % EVENTS_MAX];
+    if (h->head == h->tail && read(h->fd, &v, sizeof (v)) < 0)
+        v = 0;
+
+    plen = strlen(ev->path) + 1;
+    tlen = strlen(ev->token) + 1;
+    w = fake_alloc(2 * sizeof (char *) + plen + tlen);
+    if (!w)
+        return NULL;
+    w[XS_WATCH_PATH] = (char *)(w + 2);
+    w[XS_WATCH_TOKEN] = w[XS_WATCH_PATH] + plen;
+    memcpy(w[XS_WATCH_PATH], ev->path, plen);
+    memcpy(w[XS_WATCH_TOKEN], ev->token, tlen);
+
+    *num = 2;
+    return w;
+}
+
+xs_transaction_t xs_transaction_start(struct xs_handle *h)
+{
+    request();
+    return next_transaction++;
+}
+
+bool xs_transaction_end(struct xs_handle *h, xs_transaction_t t, bool abort)
+{
+    request();
+    return true;
+}
+
+/* libxc */
+
+struct xc_interface_core
+{
+    int                 fd;
+    evtchn_port_t       next_port;
+};
+
+static struct xc_interface_core xc_fake;
+
+xc_interface *xc_interface_open(xentoollog_logger *logger,
+                                xentoollog_logger *dombuild_logger,
+                                unsigned open_flags)
+{
+    return &xc_fake;
+}
+
+int xc_interface_close(xc_interface *xch)
+{
+    return 0;
+}
+
+xc_evtchn *xc_evtchn_open(xentoollog_logger *logger, unsigned open_flags)
+{
+    xc_evtchn *xce;
+
+    xce = fake_alloc(sizeof (*xce));
+    if (!xce)
+        return NULL;
+    xce->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    xce->next_port = 1;
+    return xce;
+}
+
+int xc_evtchn_close(xc_evtchn *xce)
+{
+    close(xce->fd);
+    free(xce);
+    return 0;
+}
+
+int xc_evtchn_fd(xc_evtchn *xce)
+{
+    return xce->fd;
+}
+
+evtchn_port_or_error_t xc_evtchn_bind_interdomain(xc_evtchn *xce, int domid,
+                                                  evtchn_port_t remote_port)
+{
+    spin(xc_latency_us);
+    return xce->next_port++;
+}
+
+int xc_evtchn_unbind(xc_evtchn *xce, evtchn_port_t port)
+{
+    return 0;
+}
+
+int xc_evtchn_notify(xc_evtchn *xce, evtchn_port_t port)
+{
+    return 0;
+}
+
+evtchn_port_or_error_t xc_evtchn_pending(xc_evtchn *xce)
+{
+    return xce->next_port - 1;
+}
+
+int xc_evtchn_unmask(xc_evtchn *xce, evtchn_port_t port)
+{
+    return 0;
+}
+
+void *xc_map_foreign_range(xc_interface *xch, uint32_t dom, int size,
+                           int prot, unsigned long mfn)
+{
+    void *p;
+
+    spin(xc_latency_us);
+    p = mmap(NULL, size, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ * 
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ * 
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __FAKE_XEN_H__
+# define __FAKE_XEN_H__
+
+# ifdef __cplusplus
+extern "C"
+{
+# endif
+
+/*
+ * In-memory stand-in for xenstored and the parts of libxc the library
+ * uses, linked into the benchmarks ahead of the real libraries: the
+ * xs_* and xc_* calls the library makes land here instead, so they can
+ * be counted and run without Xen.
+ */
+
+/* Requests made to the store, and allocations made on the way */
+extern unsigned long fake_xs_requests;
+extern unsigned long fake_xs_allocs;
+
+/* Time each store request takes, to stand for the xenstored round trip */
+void fake_xs_set_latency(unsigned int us);
+
+/* Time mapping a frontend page or binding its port takes, a hypercall */
+void fake_xc_set_latency(unsigned int us);
+
+/* Write or remove a node as the toolstack or a frontend would */
+int fake_xs_printf(const char *path, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+int fake_xs_rm(const char *path);
+int fake_xs_read_int(const char *path, int *val);
+
+/*
+ * Create a device as the toolstack would, backend in domain 0:
+ * /local/domain/0/backend/<type>/<domid>/<devid> and
+ * /local/domain/<domid>/device/<type>/<devid>, both Initialising.
+ */
+int fake_xs_add_device(const char *type, int domid, int devid);
+
+/* Hand queued watch events to backend_xenstore_handler() until none are left */
+int fake_xs_run(void);
+
+unsigned long long fake_now_ns(void);
+
+# ifdef __cplusplus
+}
+# endif
+
+#endif /* __FAKE_XEN_H__ */
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * xenbackend.hpp: devices found by start() see the derived backend
+ * constructed, a device whose constructor throws is left out, and
+ * stop() deletes the rest.
+ */
+
+#include <stdio.h>
+#include <stdexcept>
+
+#include <xenbackend.hpp>
+#include <xen/io/xenbus.h>
+
+#include "fake_xen.h"
+
+#define FE      "/local/domain/1/device/vif/0/"
+#define BE      "/local/domain/0/backend/vif/1/0/"
+
+class vif;
+
+class vifs : public xenbackend::backend<vif>
+{
+public:
+    vifs() : xenbackend::backend<vif>("vif", 1), live(0), connects(0) {}
+    ~vifs() { stop(); }
+
+    int live;
+    int connects;
+};
+
+class vif : public xenbackend::device<vif>
+{
+public:
+    vif(xenbackend::backend<vif> &b, int devid)
+        : xenbackend::device<vif>(b, devid),
+          owner_(static_cast<vifs &>(b))
+    {
+        if (devid == 1)
+            throw std::runtime_error("vif 1");
+        owner_.live++;
+    }
+    ~vif() { owner_.live--; }
+
+    int connect()
+    {
+        owner_.connects++;
+        return bind_evtchn() == -1 ? -1 : 0;
+    }
+    void disconnect() { unbind_evtchn(); }
+
+private:
+    vifs &owner_;
+};
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond);    \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+int main(int argc, char **argv)
+{
+    int state;
+
+    if (backend_init(0))
+        return 1;
+
+    fake_xs_add_device("vif", 1, 0);
+    fake_xs_add_device("vif", 1, 1);
+
+    vifs v;
+    CHECK(!v.handle());
+    v.start();
+    CHECK(v.handle());
+    fake_xs_run();
+    CHECK(v.live == 1);
+
+    fake_xs_printf(FE "event-channel", "7");
+    fake_xs_printf(FE "state", "%d", XenbusStateInitialised);
+    fake_xs_run();
+    CHECK(v.connects == 1);
+    CHECK(!fake_xs_read_int(BE "state", &state));
+    CHECK(state == XenbusStateConnected);
+
+    v.stop();
+    CHECK(!v.handle());
+    CHECK(v.live == 0);
+
+    backend_close();
+    return 0;
+}
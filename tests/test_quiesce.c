@@ -0,0 +1,181 @@
+/*
+ * Copyright (c) 2013 Citrix Systems, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * No event is dispatched to a quiesced device, whether it asks for one
+ * with backend_requeue_event() as its requests in flight complete, or
+ * spins in a busy polling window; it gets it once resumed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <xenbackend.h>
+#include <xen/io/xenbus.h>
+
+#include "fake_xen.h"
+
+#define FE      "/local/domain/1/device/vif/0/"
+#define BE      "/local/domain/0/backend/vif/1/0/"
+
+static xen_backend_t xenback;
+static int events = 0;
+static int inflight = 0;
+static int quiesce_at = 0;      /* quiesce from the nth event */
+static int drained = -1;
+
+static xen_device_t test_alloc(xen_backend_t xb, int devid,
+                               backend_private_t priv)
+{
+    return (xen_device_t)(long)(devid + 1);
+}
+
+static int test_connect(xen_device_t dev)
+{
+    return backend_bind_evtchn(xenback, 0) == -1 ? -1 : 0;
+}
+
+static void test_quiesced(int busy, void *opaque)
+{
+    drained = busy;
+}
+
+static void test_event(xen_device_t dev)
+{
+    events++;
+    if (events == quiesce_at)
+        backend_quiesce(xenback, 1000, test_quiesced, NULL);
+}
+
+/* Each check completes a request, which asks for the ring to be looked at */
+static int test_inflight(xen_device_t dev)
+{
+    if (inflight) {
+        inflight--;
+        backend_requeue_event(xenback, 0);
+    }
+    return inflight;
+}
+
+static int test_pending(xen_device_t dev)
+{
+    return events < 100;
+}
+
+static struct xen_backend_ops test_ops = {
+    test_alloc,
+    NULL,
+    test_connect,
+    NULL,
+    NULL,
+    NULL,
+    test_event,
+    NULL,
+};
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            printf("%s:%d: %s failed\n", __FILE__, __LINE__, #cond);    \
+            return 1;                                                   \
+        }                                                               \
+    } while (0)
+
+static void run_timers(void)
+{
+    int i;
+
+    for (i = 0; i < 1000 && drained == -1; i++) {
+        usleep(1000);
+        backend_timer_handler();
+    }
+}
+
+static int test_requeue(void)
+{
+    int e;
+
+    backend_set_scheduling(1);
+    drained = -1;
+    inflight = 3;
+
+    CHECK(backend_quiesce(xenback, 1000, test_quiesced, NULL) == 0);
+
+    e = events;
+    backend_requeue_event(xenback, 0);
+    backend_evtchn_handler(backend_evtchn_priv(xenback, 0));
+    CHECK(!backend_pending_events());
+
+    run_timers();
+    CHECK(drained == 0);
+    CHECK(!backend_pending_events());
+    CHECK(backend_run_events(16) == 0);
+    CHECK(events == e);
+
+    CHECK(backend_resume(xenback) == 1);
+    CHECK(backend_run_events(16) == 1);
+    CHECK(events == e + 1);
+
+    backend_set_scheduling(0);
+    return 0;
+}
+
+static int test_busy_poll(void)
+{
+    drained = -1;
+    events = 0;
+    quiesce_at = 3;
+
+    CHECK(backend_set_busy_poll(xenback, 0, 100000, test_pending) == 0);
+    backend_evtchn_handler(backend_evtchn_priv(xenback, 0));
+    CHECK(events == 3);
+
+    run_timers();
+    CHECK(drained == 0);
+    CHECK(backend_resume(xenback) == 1);
+    CHECK(backend_set_busy_poll(xenback, 0, 0, NULL) == 0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int state;
+
+    if (backend_init(0))
+        return 1;
+
+    fake_xs_add_device("vif", 1, 0);
+    xenback = backend_register("vif", 1, &test_ops, NULL);
+    CHECK(xenback);
+    backend_set_inflight(xenback, test_inflight);
+    fake_xs_run();
+
+    fake_xs_printf(FE "event-channel", "7");
+    fake_xs_printf(FE "state", "%d", XenbusStateInitialised);
+    fake_xs_run();
+    CHECK(!fake_xs_read_int(BE "state", &state));
+    CHECK(state == XenbusStateConnected);
+
+    if (test_requeue() || test_busy_poll())
+        return 1;
+
+    backend_release(xenback);
+    backend_close();
+    return 0;
+}